@@ -19,647 +19,1687 @@
    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
 */
 
+
+// The command line version of Empire: reads the province and data files,
+// and writes the output files, using the library in LibEmpire.c.
+
+// nanosleep is POSIX, glibc only declares it with -std=c99 if asked to.
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
-#include <limits.h>
-
-#define LOW_CHANCE_THRESHOLD	50 // if chance is below this threshold, create events with "convert" as the second option, not the first
-
-#define MAX_TAGS                100
-#define MAX_STRINGS             100
-#define MAX_TAG_LENGTH          50
-#define MAX_STRING_LENGTH       2048
-#define MAX_EVENT_DATA          100
-#define MAX_PROVINCES           3000
-#define MAX_PROVINCENAME_LENGTH 100
-
-// Defines for keyword tags.
-#define TAG_FILE_ID         0
-#define TAG_RNGC            1
-#define TAG_EVENT_ID_PREFIX 2
-#define TAG_OUTPUT_FILE     3
-#define TAG_SET_STRING      4
-#define TAG_TARGET_STRING   5
-#define TAG_START_CONDITION 6
-#define TAG_EVENT_DATA      7
-#define TAG_MODIFICATION    8
-#define TAG_END_OF_DATA     9
-#define TAG_OUTPUT_FILE_MOD 10
-#define TAG_OUTPUT_FILE_MOD_HEADER 11
-#define TAG_FIRST_USER_TAG  12
-
-static FILE *ifp, *ofp, *omfp;
-static int LineNumber, NumErrors = 0, NumWarnings = 0;
-static int TagIndex = TAG_FIRST_USER_TAG, StringIndex = 0;
-static char TagArray[MAX_TAGS][MAX_TAG_LENGTH + 1]; // + 1 for null termination.
-static char StringArray[MAX_STRINGS][MAX_STRING_LENGTH + 1]; // + 1 for null termination.
-static char LatestString[MAX_STRING_LENGTH + 1]; // + 1 for null termination.
-
-static int RNGCTag = INT_MAX;
-static int EventIDPrefix = INT_MAX;
-static int UserStringsIndexArray[MAX_STRINGS];
-static int LargestProvinceID = 0;
-static int EventData[MAX_EVENT_DATA][4]; // Tag, NameStr, DescStr, CommandStr
-static int EventDataIndex = 0;
-static char ProvinceEventIndex[MAX_EVENT_DATA][MAX_PROVINCES]; // The running event ID for each province.
-static char ProvinceNames[MAX_PROVINCES][MAX_PROVINCENAME_LENGTH + 1]; // + 1 for null termination.
-static char OutputFileModHeader[MAX_STRING_LENGTH + 1];
-
-// Helper functions for file parsing.
-// Externals used: FILE *ifp, int LineNumber, int NumErrors, int NumWarnings,
-// char TagArray[][], int TagIndex, char LatestString[]
-
-int IsWhitespace(int c)
+#include <math.h>
+#include <stdarg.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <pthread.h>
+#include <dirent.h>
+#endif
+#ifdef __linux__
+#include <poll.h>
+#include <sys/inotify.h>
+#endif
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#include <io.h>
+#include <fcntl.h>
+#endif
+#include "Empire.h"
+
+static int NumErrors = 0, NumWarnings = 0;
+static int NumThreads = 1;
+static int ReportIO = 0;    // -v: report the writes made for each file.
+static int Incremental = 0; // -i: only write the files that changed.
+static int Compact = 0;     // -c: write the events compacted.
+static int ShowStats = 0;   // --stats: report the time and work of each phase.
+static const char *TraceFile = NULL; // --trace: where to write the trace.
+static const char *RegistryFile = NULL; // --ids: the event ID registry.
+static const char *OverlapFile = NULL;  // --overlaps: where to write the report.
+static const char *EventDir = NULL;     // --events: the mod's event directory.
+static int TarOutput = 0;               // --tar: write the outputs to stdout as a tar archive.
+static long long SimTrials = 0;         // --simulate: trials per province and EventData.
+
+// Memory helpers. Running out of memory isn't something we can recover
+// from, so just bail out.
+void *MemAlloc(size_t Size)
 {
-    return(c >= 0 && c <= 32);
+    void *p = malloc(Size > 0 ? Size : 1);
+
+    if (p == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    return(p);
 }
 
-int GetChar()
+void Quit(int HaltOnExit)
 {
-    int c = fgetc(ifp);
-    if ((char)c == '\n' || (char)c == '\r') {
-        LineNumber++;
+    fprintf(stderr, "Execution completed with %d errors and %d warnings\n", NumErrors, NumWarnings);
+    if (HaltOnExit > 0) {
+        if (HaltOnExit > 1 || NumErrors > 0 || NumWarnings > 0) {
+            fprintf(stderr, "\nPress return to continue...\n");
+            (void)getchar();
+        }
     }
-    return(c);
+    exit(NumErrors);
 }
 
-void UnGetChar(int c)
+// --stats and --trace. Each phase of a run is timed, and with --trace the
+// phases, the rendering of each OutputFile section (per thread) and the
+// writing of each file are written out in the Chrome trace format, for
+// chrome://tracing or Perfetto.
+#define PHASE_PROVINCES 0
+#define PHASE_PARSE     1
+#define PHASE_CACHE     2
+#define PHASE_GENERATE  3
+#define PHASE_WRITE     4
+#define NUM_PHASES      5
+
+static const char *PhaseNames[NUM_PHASES] = {
+    "province file", "parse", "cache", "generate", "write"
+};
+
+typedef struct {
+    char *Name;
+    const char *Category;
+    int Thread, Line;
+    double Start, End;
+} TraceEvent;
+
+static double TraceStart;
+
+// One data file and its context. When several data files are given they are
+// compiled at the same time, each by its own thread, sharing the province
+// names. What each has to say is then kept in its Log and printed when it's
+// done, so the messages of different files don't get mixed up.
+typedef struct {
+    const char *FileName;
+    Empire *E;
+    int NumErrors, NumWarnings;
+    int Written, NumOutputs;   // Of the last compile.
+    int Buffered;              // Collect the messages in Log.
+    char *Log;
+    size_t LogLen, LogSize;
+    double PhaseTimes[NUM_PHASES]; // Microseconds, for the current run.
+    TraceEvent *TraceEvents;
+    int NumTraceEvents, TraceEventsSize;
+    char *Overlaps;            // --overlaps: the entries of the report, as JSON.
+    size_t OverlapsLen, OverlapsSize;
+} Job;
+
+static Job *Jobs = NULL;
+static int NumJobs = 0;
+
+// Append to a text buffer, growing it as needed.
+void AppendText(char **Buf, size_t *Len, size_t *Size, const char *Format, va_list Args)
 {
-    // Don't bother ungetting whitespace, will be scanned away next anyway
-    // (ungetting newlines would screw up the line counting).
-    if (!IsWhitespace(c)) {
-        ungetc(c, ifp);
+    va_list Copy;
+    int n;
+
+    while (1) {
+        va_copy(Copy, Args);
+        n = vsnprintf(*Buf + *Len, *Size - *Len, Format, Copy);
+        va_end(Copy);
+        if (n >= 0 && *Len + n < *Size) {
+            *Len += n;
+            return;
+        }
+        *Size = *Size > 0 ? *Size * 2 : 4096;
+        *Buf = realloc(*Buf, *Size);
+        if (*Buf == NULL) {
+            fprintf(stderr, "Out of memory\n");
+            exit(EXIT_FAILURE);
+        }
     }
 }
 
-void SkipRestOfLine()
+void Report(Job *J, const char *Format, ...)
 {
-    int c;
+    va_list Args;
 
-    do {
-        c = GetChar();
-    } while ((char)c != '\n' && (char)c != '\r' && c != EOF);
+    va_start(Args, Format);
+    if (J->Buffered) {
+        AppendText(&J->Log, &J->LogLen, &J->LogSize, Format, Args);
+    } else {
+        vfprintf(stderr, Format, Args);
+    }
+    va_end(Args);
+}
+
+void FlushLog(Job *J)
+{
+    if (J->LogLen > 0) {
+        fwrite(J->Log, 1, J->LogLen, stderr);
+        J->LogLen = 0;
+    }
 }
 
-void SkipWhitespacesAndComments()
+void PrintDiagnostic(void *User, const EmpireDiagnostic *Diag)
 {
-    int c = GetChar();
+    Job *J = User;
 
-    while ((char)c == '#' || IsWhitespace(c)) {
-        if ((char)c == '#') {
-            SkipRestOfLine();
-            c = GetChar();
-        }
-        while (IsWhitespace(c)) {
-            c = GetChar();
+    if (Diag->Severity == EMPIRE_ERROR) {
+        Report(J, "Error: line %d: %s\n", Diag->Line, Diag->Message);
+        J->NumErrors++;
+    } else {
+        Report(J, "Warning: line %d: %s\n", Diag->Line, Diag->Message);
+        J->NumWarnings++;
+    }
+}
+
+// Line is that of the OutputFile, or 0.
+void AddTraceEvent(Job *J, const char *Name, const char *Category, int Thread, int Line, double Start, double End)
+{
+    TraceEvent *Event;
+
+    if (J->NumTraceEvents >= J->TraceEventsSize) {
+        J->TraceEventsSize = J->TraceEventsSize > 0 ? J->TraceEventsSize * 2 : 256;
+        J->TraceEvents = realloc(J->TraceEvents, J->TraceEventsSize * sizeof(TraceEvent));
+        if (J->TraceEvents == NULL) {
+            fprintf(stderr, "Out of memory\n");
+            exit(EXIT_FAILURE);
         }
     }
-    UnGetChar(c);
+    Event = &J->TraceEvents[J->NumTraceEvents++];
+    Event->Name = MemAlloc(strlen(Name) + 1);
+    strcpy(Event->Name, Name);
+    Event->Category = Category;
+    Event->Thread = Thread;
+    Event->Line = Line;
+    Event->Start = Start;
+    Event->End = End;
 }
 
-void Error(char *s, int c)
+void ClearTrace(Job *J)
 {
-    if (c == 0) {
-        // Semantic, rather than syntax error, only print the message.
-        fprintf(stderr, "Error: line %d: %s\n", LineNumber, s);
-    } else {
-        // Syntax error, print the offending character as well as the message.
-        if (c == EOF) {
-            fprintf(stderr, "Error: line %d: %s, found EOF\n", LineNumber, s);
+    int i;
+
+    for (i=0; i<J->NumTraceEvents; i++) {
+        free(J->TraceEvents[i].Name);
+    }
+    J->NumTraceEvents = 0;
+}
+
+// End the phase begun at Start. Returns the time, the start of the next phase.
+double EndPhase(Job *J, int Phase, double Start)
+{
+    double Now = EmpireClock();
+
+    J->PhaseTimes[Phase] += Now - Start;
+    if (TraceFile != NULL) {
+        AddTraceEvent(J, PhaseNames[Phase], "phase", 0, 0, Start, Now);
+    }
+    return(Now);
+}
+
+void WriteJSONString(FILE *fp, const char *s)
+{
+    fputc('"', fp);
+    for (; *s != 0; s++) {
+        if (*s == '"' || *s == '\\') {
+            fprintf(fp, "\\%c", *s);
+        } else if ((unsigned char)*s < 0x20) {
+            fprintf(fp, "\\u%04x", (unsigned char)*s);
         } else {
-            fprintf(stderr, "Error: line %d: %s, found '%c'\n", LineNumber, s, (char)c);
+            fputc(*s, fp);
         }
     }
-    NumErrors++;
+    fputc('"', fp);
 }
 
-void Warning(char *s, int c)
+// Each data file is a process in the trace.
+void WriteTrace(void)
 {
-    if (c == 0) {
-        // Semantic, rather than syntax warning, only print the message.
-        fprintf(stderr, "Warning: line %d: %s\n", LineNumber, s);
-    } else {
-        // Syntax warning, print the offending character as well as the message.
-        if (c == EOF) {
-            fprintf(stderr, "Warning: line %d: %s, found EOF\n", LineNumber, s);
-        } else {
-            fprintf(stderr, "Warning: line %d: %s, found '%c'\n", LineNumber, s, c);
+    TraceEvent *Event;
+    FILE *fp;
+    int i, j, First = 1;
+
+    fp = fopen(TraceFile, "w");
+    if (fp == NULL) {
+        fprintf(stderr, "Warning: can't write the trace file %s\n", TraceFile);
+        NumWarnings++;
+        return;
+    }
+    fprintf(fp, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [");
+    for (j=0; j<NumJobs; j++) {
+        fprintf(fp, "%s\n{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": %d, \"args\": {\"name\": ",
+                First ? "" : ",", j + 1);
+        WriteJSONString(fp, Jobs[j].FileName);
+        fprintf(fp, "}}");
+        First = 0;
+        for (i=0; i<Jobs[j].NumTraceEvents; i++) {
+            Event = &Jobs[j].TraceEvents[i];
+            fprintf(fp, ",\n{\"name\": ");
+            WriteJSONString(fp, Event->Name);
+            fprintf(fp, ", \"cat\": \"%s\", \"ph\": \"X\", \"pid\": %d, \"tid\": %d, \"ts\": %.1f, \"dur\": %.1f",
+                    Event->Category, j + 1, Event->Thread, Event->Start - TraceStart, Event->End - Event->Start);
+            if (Event->Line > 0) {
+                fprintf(fp, ", \"args\": {\"line\": %d}", Event->Line);
+            }
+            fprintf(fp, "}");
         }
     }
-    NumWarnings++;
+    fprintf(fp, "\n]}\n");
+    fclose(fp);
 }
 
-void VerifyListStart()
+// The overlap report (--overlaps): for each data file, the pairs of
+// Modifications changing a province at the same time, in JSON.
+void AddOverlapEntry(Job *J, const char *Format, ...)
 {
-    int c;
+    va_list Args;
+
+    va_start(Args, Format);
+    AppendText(&J->Overlaps, &J->OverlapsLen, &J->OverlapsSize, Format, Args);
+    va_end(Args);
+}
 
-    SkipWhitespacesAndComments();
-    c = GetChar();
-    if ((char)c != '(') {
-        Error("expected '('", c);
-        UnGetChar(c);
+// A YYYYMMDD date as in the data file.
+const char *FormatDate(char *Buf, int Date)
+{
+    sprintf(Buf, "%04d-%02d-%02d", Date / 10000 % 10000, Date / 100 % 100, Date % 100);
+    return(Buf);
+}
+
+void FindOverlaps(Job *J)
+{
+    const EmpireOverlap *Overlap;
+    char Dates[4][16];
+    int i, n, Conflicts = 0;
+
+    n = EmpireFindOverlaps(J->E);
+    for (i=0; i<n; i++) {
+        Overlap = EmpireGetOverlap(J->E, i);
+        Conflicts += Overlap->Conflict;
+        AddOverlapEntry(J, "%s\n    {\"province\": %d, \"conflict\": %s, "
+                        "\"first\": {\"line\": %d, \"event_data\": \"%s\", \"start\": \"%s\", \"end\": \"%s\"}, "
+                        "\"second\": {\"line\": %d, \"event_data\": \"%s\", \"start\": \"%s\", \"end\": \"%s\"}}",
+                        i > 0 ? "," : "", Overlap->ProvinceID, Overlap->Conflict ? "true" : "false",
+                        Overlap->Line1, Overlap->EventData1, FormatDate(Dates[0], Overlap->Start1),
+                        FormatDate(Dates[1], Overlap->End1), Overlap->Line2, Overlap->EventData2,
+                        FormatDate(Dates[2], Overlap->Start2), FormatDate(Dates[3], Overlap->End2));
+    }
+    Report(J, "Found %d overlapping Modifications (%d with different EventData)\n", n, Conflicts);
+}
+
+void WriteOverlaps(void)
+{
+    FILE *fp;
+    int j;
+
+    fp = fopen(OverlapFile, "w");
+    if (fp == NULL) {
+        fprintf(stderr, "Warning: can't write the overlap report %s\n", OverlapFile);
+        NumWarnings++;
         return;
     }
-    return;
+    fprintf(fp, "{\"data_files\": [");
+    for (j=0; j<NumJobs; j++) {
+        fprintf(fp, "%s\n  {\"name\": ", j > 0 ? "," : "");
+        WriteJSONString(fp, Jobs[j].FileName);
+        fprintf(fp, ", \"errors\": %d, \"overlaps\": [", Jobs[j].NumErrors);
+        if (Jobs[j].OverlapsLen > 0) {
+            fwrite(Jobs[j].Overlaps, 1, Jobs[j].OverlapsLen, fp);
+            fprintf(fp, "\n  ");
+        }
+        fprintf(fp, "]}");
+    }
+    fprintf(fp, "\n]}\n");
+    fclose(fp);
 }
 
-void VerifyListEnd()
+// Simulation (--simulate N): the conversion rates of each region (the
+// OutputFile the RNGC events go to) and EventData, and with -v of each
+// province. A province whose simulated rate is off from what the data file
+// says gets a warning.
+static const char *FlagNames[3] = {"Small", "Normal", "Large"};
+
+int CompareSimResults(const void *a, const void *b)
 {
+    const EmpireSimResult *x = *(const EmpireSimResult **)a, *y = *(const EmpireSimResult **)b;
     int c;
 
-    SkipWhitespacesAndComments();
-    c = GetChar();
-    if ((char)c != ')') {
-        Error("expected ')'", c);
-        UnGetChar(c);
+    if ((c = strcmp(x->FileName, y->FileName)) != 0 || (c = strcmp(x->EventData, y->EventData)) != 0) {
+        return(c);
+    }
+    return(x->ProvinceID < y->ProvinceID ? -1 : x->ProvinceID > y->ProvinceID);
+}
+
+void Simulate(Job *J)
+{
+    const EmpireSimResult **Results, *r;
+    double Rate[3], Expected[3], Historical[3], Error[3], Sigma;
+    int i, j, f, n;
+
+    n = EmpireSimulate(J->E, SimTrials);
+    if (n == 0) {
         return;
     }
-    return;
+    Report(J, "Simulated %lld trials for each province and EventData\n", EmpireGetSimResult(J->E, 0)->Trials);
+    Results = MemAlloc(n * sizeof(EmpireSimResult *));
+    for (i=0; i<n; i++) {
+        Results[i] = EmpireGetSimResult(J->E, i);
+        for (f=0; f<3; f++) {
+            r = Results[i];
+            Sigma = sqrt(r->Expected[f] * (1.0 - r->Expected[f]) / r->Trials);
+            if (fabs(r->Rate[f] - r->Expected[f]) > 5 * Sigma + 1e-9) {
+                Report(J, "Warning: province %d %s %s: simulated %.2f%%, but the data file gives %.2f%%\n",
+                       r->ProvinceID, r->EventData, FlagNames[f], 100 * r->Rate[f], 100 * r->Expected[f]);
+                J->NumWarnings++;
+            }
+        }
+    }
+    qsort(Results, n, sizeof(EmpireSimResult *), CompareSimResults);
+    for (i=0; i<n; i=j) {
+        memset(Rate, 0, sizeof(Rate));
+        memset(Expected, 0, sizeof(Expected));
+        memset(Historical, 0, sizeof(Historical));
+        memset(Error, 0, sizeof(Error));
+        for (j=i; j<n && strcmp(Results[i]->FileName, Results[j]->FileName) == 0 &&
+             strcmp(Results[i]->EventData, Results[j]->EventData) == 0; j++) {
+            for (f=0; f<3; f++) {
+                Rate[f] += Results[j]->Rate[f];
+                Expected[f] += Results[j]->Expected[f];
+                Historical[f] += Results[j]->Historical[f];
+                Error[f] += Results[j]->Error[f] * Results[j]->Error[f];
+            }
+        }
+        Report(J, "  %s, %s (%d provinces):\n", Results[i]->FileName, Results[i]->EventData, j - i);
+        for (f=0; f<3; f++) {
+            Report(J, "    %-6s %6.2f%% +- %.2f, data file %6.2f%%, historical %6.2f%%\n", FlagNames[f],
+                   100 * Rate[f] / (j - i), 100 * sqrt(Error[f]) / (j - i), 100 * Expected[f] / (j - i),
+                   100 * Historical[f] / (j - i));
+        }
+        if (ReportIO) {
+            for (f=i; f<j; f++) {
+                r = Results[f];
+                Report(J, "    province %d: Small %.2f%% +- %.2f, Normal %.2f%% +- %.2f, Large %.2f%% +- %.2f\n",
+                       r->ProvinceID, 100 * r->Rate[0], 100 * r->Error[0], 100 * r->Rate[1], 100 * r->Error[1],
+                       100 * r->Rate[2], 100 * r->Error[2]);
+            }
+        }
+    }
+    free(Results);
+}
+
+void PrintStats(Job *J)
+{
+    const EmpireStats *Stats = EmpireGetStats(J->E);
+    const EmpireOutput *Output;
+    int i;
+
+    Report(J, "Stats for %s:\n", J->FileName);
+    for (i=0; i<NUM_PHASES; i++) {
+        Report(J, "  %-24s %10.3f ms\n", PhaseNames[i], J->PhaseTimes[i] / 1000.0);
+    }
+    Report(J, "  %-24s %10lld\n", "tags looked up", Stats->TagLookups);
+    Report(J, "  %-24s %10lld (%lld more reused)\n", "strings expanded", Stats->StringExpansions,
+           Stats->ExpansionCacheHits);
+    Report(J, "  %-24s %10lld\n", "Modifications rendered", Stats->Modifications);
+    Report(J, "  %-24s %10lld (%.2f per Modification, at most %d)\n", "RNGC events", Stats->RNGCEvents,
+           Stats->Modifications > 0 ? (double)Stats->RNGCEvents / Stats->Modifications : 0.0, Stats->MaxRNGCEvents);
+    for (i=0; i<EmpireNumOutputs(J->E); i++) {
+        Output = EmpireGetOutput(J->E, i);
+        if (Output->Skip) {
+            Report(J, "  %10s bytes %s\n", "unchanged", Output->FileName);
+        } else {
+            Report(J, "  %10lu bytes %s\n", (unsigned long)Output->Len, Output->FileName);
+        }
+    }
 }
 
-int GetNum()
+// An input file. The whole file is mapped (or, where mapping isn't
+// available, read) into memory.
+typedef struct {
+    const char *Buf;
+    size_t Size;
+    int Mapped;
+} InputFile;
+
+int OpenInput(InputFile *In, const char *FileName)
 {
-    int Num, c;
+#ifndef _WIN32
+    struct stat st;
+    int fd;
+    ssize_t n;
+    size_t Size;
+    char *Buf;
 
-    SkipWhitespacesAndComments();
-    if (fscanf(ifp, "%d", &Num) != 1) {
-        c = GetChar();
-        Error("expected a number", c);
-        UnGetChar(c);
-        return(INT_MAX);
+    fd = open(FileName, O_RDONLY);
+    if (fd < 0) {
+        return(-1);
+    }
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return(-1);
+    }
+    Size = (size_t)st.st_size;
+    In->Mapped = 0;
+    Buf = NULL;
+    if (Size > 0) {
+        Buf = mmap(NULL, Size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (Buf == MAP_FAILED) {
+            // Not mappable (a pipe or some special file system), read it instead.
+            Buf = malloc(Size);
+            if (Buf == NULL) {
+                close(fd);
+                return(-1);
+            }
+            Size = 0;
+            while ((n = read(fd, Buf + Size, (size_t)st.st_size - Size)) > 0) {
+                Size += (size_t)n;
+            }
+        } else {
+            In->Mapped = 1;
+        }
+    }
+    close(fd);
+#else
+    // Read in text mode, so line endings end up the same as with stdio.
+    FILE *fp;
+    long Size;
+    char *Buf;
+
+    fp = fopen(FileName, "r");
+    if (fp == NULL) {
+        return(-1);
+    }
+    fseek(fp, 0, SEEK_END);
+    Size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    Buf = malloc(Size > 0 ? (size_t)Size : 1);
+    if (Buf == NULL) {
+        fclose(fp);
+        return(-1);
     }
-    return(Num);
+    In->Size = fread(Buf, 1, Size > 0 ? (size_t)Size : 0, fp);
+    In->Mapped = 0;
+    fclose(fp);
+#endif
+#ifndef _WIN32
+    In->Size = Size;
+#endif
+    In->Buf = Buf;
+    return(0);
 }
 
-int GetDate()
+void CloseInput(InputFile *In)
 {
-    int y, m, d, c;
-
-    y = GetNum();
-    c = GetChar();
-    if (c != '-') {
-        Error("expected '-'", c);
-        UnGetChar(c);
-    }
-    m = GetNum();
-    c = GetChar();
-    if (c != '-') {
-        Error("expected '-'", c);
-        UnGetChar(c);
-    }
-    d = GetNum();
-    return(y * 10000 + m * 100 + d);
+    if (In->Buf != NULL) {
+#ifndef _WIN32
+        if (In->Mapped) {
+            munmap((void *)In->Buf, In->Size);
+        } else
+#endif
+        {
+            free((void *)In->Buf);
+        }
+    }
+    In->Buf = NULL;
+    In->Size = 0;
+    In->Mapped = 0;
 }
 
-// Check if d is a valid date on yyyymmdd form (allow less y:s too).
-// Not sure exactly what the EU II engine requires, but for simplicity
-// check for 1 <= year <= 9999, 1 <= month <= 12, 1 <= day <= 30.
-// (Day 31 is not used at any rate, feb 29 and 30 is also not used but
-// I think february is still 30 days for span calculations, so allow them
-// anyway (will be converted to march 1 later on).)
-int VerifyDate(int date) {
-    int year, month, day;
-
-    day = date % 100;
-    date = date / 100;
-    month = date % 100;
-    year = date / 100;
-    if (year < 1 || year > 9999) {
-        return(0);
-    }
-    if (month < 1 || month > 12) {
-        return(0);
-    }
-    if (day < 1 || day > 30) {
-        return(0);
-    }
-    return(1);
+// Read all of stdin, for a data file given as "-".
+int ReadStdin(InputFile *In)
+{
+    size_t Size = 65536, Len = 0, n;
+    char *Buf = MemAlloc(Size);
+
+    while ((n = fread(Buf + Len, 1, Size - Len, stdin)) > 0) {
+        Len += n;
+        if (Len == Size) {
+            Size *= 2;
+            Buf = realloc(Buf, Size);
+            if (Buf == NULL) {
+                fprintf(stderr, "Out of memory\n");
+                exit(EXIT_FAILURE);
+            }
+        }
+    }
+    In->Buf = Buf;
+    In->Size = Len;
+    In->Mapped = 0;
+    return(ferror(stdin) ? -1 : 0);
 }
 
-int GetTag()
+// The output writer. Small pieces (headers, TargetStrings, StartConditions)
+// are copied into one big owned block, while the rendered events are queued
+// as they are. The queue is written with one writev (or, on Windows,
+// one fwrite per piece of a block) when it holds OUT_BLOCK_SIZE bytes or
+// OUT_MAX_PIECES pieces, so a file takes a handful of writes instead of
+// several per event.
+#define OUT_BLOCK_SIZE  (1 << 20)
+#define OUT_MAX_PIECES  64
+
+typedef struct {
+    const char *Ptr;
+    size_t Len;
+} OutPiece;
+
+typedef struct {
+#ifndef _WIN32
+    int fd;
+#else
+    FILE *fp;
+#endif
+    char *Block;       // The owned block for small pieces.
+    size_t BlockLen;
+    OutPiece Pieces[OUT_MAX_PIECES];
+    int NumPieces;
+    size_t Pending;    // Bytes queued but not written.
+    long long Bytes;   // Bytes written to this file.
+    int Syscalls;      // Write calls made for this file.
+    int Failed;
+} OutFile;
+
+int OutOpen(OutFile *Out, const char *FileName)
 {
-    int c, i = 0;
-    char Tag[MAX_TAG_LENGTH + 1]; // + 1 for null termination.
-
-    SkipWhitespacesAndComments();
-    c = GetChar();
-    // The first character should be a letter.
-    if (((char)c >= 'a' && (char)c <= 'z') ||
-        ((char)c >= 'A' && (char)c <= 'Z')) {
-        Tag[i++] = (char)c;
+    memset(Out, 0, sizeof(OutFile));
+#ifndef _WIN32
+    Out->fd = open(FileName, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (Out->fd < 0) {
+        return(-1);
+    }
+#else
+    Out->fp = fopen(FileName, "w");
+    if (Out->fp == NULL) {
+        return(-1);
+    }
+    // We do our own buffering.
+    setvbuf(Out->fp, NULL, _IONBF, 0);
+#endif
+    Out->Block = MemAlloc(OUT_BLOCK_SIZE);
+    return(0);
+}
+
+// Write everything queued.
+void OutFlush(OutFile *Out)
+{
+#ifndef _WIN32
+    struct iovec Iov[OUT_MAX_PIECES];
+    struct iovec *v = Iov;
+    int n = Out->NumPieces, i;
+    ssize_t Done;
+
+    for (i=0; i<n; i++) {
+        Iov[i].iov_base = (void *)Out->Pieces[i].Ptr;
+        Iov[i].iov_len = Out->Pieces[i].Len;
+    }
+    while (n > 0 && !Out->Failed) {
+        Done = writev(Out->fd, v, n);
+        Out->Syscalls++;
+        if (Done < 0) {
+            Out->Failed = 1;
+            break;
+        }
+        Out->Bytes += Done;
+        // Skip what got written, in case it was a short write.
+        while (n > 0 && (size_t)Done >= v->iov_len) {
+            Done -= v->iov_len;
+            v++;
+            n--;
+        }
+        if (n > 0) {
+            v->iov_base = (char *)v->iov_base + Done;
+            v->iov_len -= Done;
+        }
+    }
+#else
+    int i;
+
+    for (i=0; i<Out->NumPieces && !Out->Failed; i++) {
+        Out->Syscalls++;
+        if (fwrite(Out->Pieces[i].Ptr, 1, Out->Pieces[i].Len, Out->fp) != Out->Pieces[i].Len) {
+            Out->Failed = 1;
+        }
+        Out->Bytes += Out->Pieces[i].Len;
+    }
+#endif
+    Out->NumPieces = 0;
+    Out->Pending = 0;
+    Out->BlockLen = 0;
+}
+
+void OutQueue(OutFile *Out, const char *s, size_t Len)
+{
+    if (Out->NumPieces == OUT_MAX_PIECES) {
+        OutFlush(Out);
+    }
+    Out->Pieces[Out->NumPieces].Ptr = s;
+    Out->Pieces[Out->NumPieces].Len = Len;
+    Out->NumPieces++;
+    Out->Pending += Len;
+    if (Out->Pending >= OUT_BLOCK_SIZE) {
+        OutFlush(Out);
+    }
+}
+
+// Copy a piece into the block.
+void OutCopy(OutFile *Out, const char *s, size_t Len)
+{
+    OutPiece *Last;
+
+    if (Len > OUT_BLOCK_SIZE) {
+        // Too big to copy, write it before it goes away.
+        OutQueue(Out, s, Len);
+        OutFlush(Out);
+        return;
+    }
+    if (Out->BlockLen + Len > OUT_BLOCK_SIZE) {
+        OutFlush(Out);
+    }
+    memcpy(Out->Block + Out->BlockLen, s, Len);
+    Out->BlockLen += Len;
+    Last = Out->NumPieces > 0 ? &Out->Pieces[Out->NumPieces - 1] : NULL;
+    if (Last != NULL && Last->Ptr + Last->Len == Out->Block + Out->BlockLen - Len) {
+        // Extends the previous copy.
+        Last->Len += Len;
+        Out->Pending += Len;
+        if (Out->Pending >= OUT_BLOCK_SIZE) {
+            OutFlush(Out);
+        }
+        return;
+    }
+    OutQueue(Out, Out->Block + Out->BlockLen - Len, Len);
+}
+
+// Queue a piece that lives until the file is closed.
+// Short ones are copied anyway, to keep the number of pieces down.
+void OutWrite(OutFile *Out, const char *s, size_t Len)
+{
+    if (Len == 0) {
+        return;
+    }
+    if (Len >= 4096) {
+        OutQueue(Out, s, Len);
     } else {
-        Error("expected a tag (starting with a letter)", c);
-        UnGetChar(c);
-        return(INT_MAX);
-    }
-    // The remaining characters should be alphanumeric.
-    c = GetChar();
-    while (((char)c >= 'a' && (char)c <= 'z') ||
-           ((char)c >= 'A' && (char)c <= 'Z') ||
-           ((char)c >= '0' && (char)c <= '9')) {
-        if (i < MAX_TAG_LENGTH) {
-            Tag[i++] = (char)c;
-        } else if (i == MAX_TAG_LENGTH) { // Don't warn for every extra character...
-            Warning("tag too long, truncating", 0);
-        }
-        c = GetChar();
-    }
-    UnGetChar(c);
-    // Null terminate.
-    Tag[i] = 0;
-    // Check if it's an already known tag.
-    for (i=0; i<TagIndex; i++) {
-        if (strcmp(TagArray[i], Tag) == 0) {
-            // Already known tag.
-            return(i);
-        }
-    }
-
-    // New tag, insert if possible.
-    if (TagIndex >= MAX_TAGS) {
-        Error("Too many tags", 0);
-        return(INT_MAX);
-    }
-    strcpy(TagArray[TagIndex], Tag);
-    TagIndex++;
-    return(TagIndex - 1);
+        OutCopy(Out, s, Len);
+    }
+}
+
+// Flush and close. Returns -1 if any write failed.
+int OutClose(OutFile *Out)
+{
+    OutFlush(Out);
+    free(Out->Block);
+    Out->Block = NULL;
+#ifndef _WIN32
+    if (close(Out->fd) != 0) {
+        Out->Failed = 1;
+    }
+#else
+    if (fclose(Out->fp) != 0) {
+        Out->Failed = 1;
+    }
+#endif
+    return(Out->Failed ? -1 : 0);
 }
 
-int GetString()
+// Write to stdout instead of a file.
+void OutOpenStdout(OutFile *Out)
 {
-    int c, i = 0;
-
-    SkipWhitespacesAndComments();
-    c = GetChar();
-    // The first character should be a '"'.
-    if ((char)c != '"') {
-        Error("expected a string (within '\"' characters)", c);
-        UnGetChar(c);
-        return(INT_MAX);
-    }
-    // Copy all characters until the next '"' if possible.
-    c = GetChar();
-    while ((char)c != '"') {
-        if (c == EOF) {
-            Error("expected string termination ('\"')", c);
-            return(INT_MAX);
-        }
-        if (i < MAX_STRING_LENGTH) {
-            LatestString[i++] = (char)c;
-        } else if (i == MAX_STRING_LENGTH) { // Don't warn for every extra character...
-            Warning("string too long, truncating", 0);
-        }
-        c = GetChar();
-    }
-    // Don't unget the terminating '"'.
-    // Null terminate.
-    LatestString[i] = 0;
+    memset(Out, 0, sizeof(OutFile));
+#ifndef _WIN32
+    Out->fd = STDOUT_FILENO;
+#else
+    _setmode(_fileno(stdout), _O_BINARY);
+    Out->fp = stdout;
+#endif
+    Out->Block = MemAlloc(OUT_BLOCK_SIZE);
+}
+
+// Streaming (--tar): the output files are written to stdout as one tar
+// archive (POSIX ustar) instead of to files, so they can be piped into a
+// packaging step. The data files compiled at the same time take turns
+// adding their files.
+static OutFile Archive;
+static long long ArchiveTime;
+static const char TarZeros[1024];
+#ifndef _WIN32
+static pthread_mutex_t ArchiveLock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+// Fill in the 512 byte header of a file. Returns -1 if the name doesn't fit.
+int TarHeader(char *Header, const char *FileName, unsigned long long Size)
+{
+    char Name[257];
+    size_t Len = strlen(FileName), i;
+    unsigned int Sum = 0;
+
+    if (Len >= sizeof(Name)) {
+        return(-1);
+    }
+    for (i=0; i<=Len; i++) {
+        Name[i] = FileName[i] == '\\' ? '/' : FileName[i];
+    }
+    memset(Header, 0, 512);
+    if (Len <= 100) {
+        memcpy(Header, Name, Len);
+    } else {
+        // Longer names are split at a slash into a prefix and the name.
+        for (i=Len-101; i<Len && i<=155 && Name[i] != '/'; i++) {
+        }
+        if (i >= Len || i > 155) {
+            return(-1);
+        }
+        memcpy(Header + 345, Name, i);
+        memcpy(Header, Name + i + 1, Len - i - 1);
+    }
+    sprintf(Header + 100, "%07o", 0644);
+    sprintf(Header + 108, "%07o", 0);
+    sprintf(Header + 116, "%07o", 0);
+    sprintf(Header + 124, "%011llo", Size);
+    sprintf(Header + 136, "%011llo", (unsigned long long)ArchiveTime);
+    Header[156] = '0';
+    memcpy(Header + 257, "ustar", 6);
+    memcpy(Header + 263, "00", 2);
+    // The checksum is counted with its own field as spaces.
+    memset(Header + 148, ' ', 8);
+    for (i=0; i<512; i++) {
+        Sum += (unsigned char)Header[i];
+    }
+    sprintf(Header + 148, "%06o", Sum);
     return(0);
 }
 
-void Quit(int HaltOnExit)
+void OpenArchive(void)
 {
-    fprintf(stderr, "Execution completed with %d errors and %d warnings\n", NumErrors, NumWarnings);
-    if (ifp != NULL) {
-        fclose(ifp);
+    ArchiveTime = (long long)time(NULL);
+    OutOpenStdout(&Archive);
+}
+
+// Add an output to the archive. Returns -1 on failure.
+int ArchiveOutput(Job *J, const EmpireOutput *Output)
+{
+    char Header[512];
+    int i;
+
+    if (TarHeader(Header, Output->FileName, Output->Len) != 0) {
+        Report(J, "Error: line %d: the output file name is too long for a tar archive\n", Output->Line);
+        J->NumErrors++;
+        return(-1);
     }
-    if (ofp != NULL) {
-        fclose(ofp);
+    OutCopy(&Archive, Header, sizeof(Header));
+    for (i=0; i<Output->NumPieces; i++) {
+        OutWrite(&Archive, Output->Pieces[i].Ptr, Output->Pieces[i].Len);
     }
-	if (omfp != NULL) {
-		fclose(omfp);
-	}
-    if (HaltOnExit > 0) {
-        if (HaltOnExit > 1 || NumErrors > 0 || NumWarnings > 0) {
-            fprintf(stderr, "\nPress return to continue...\n");
-            (void)getchar();
+    OutCopy(&Archive, TarZeros, (512 - Output->Len % 512) % 512);
+    return(0);
+}
+
+// End the archive with two empty blocks. Returns -1 if any write failed.
+int CloseArchive(void)
+{
+    OutCopy(&Archive, TarZeros, sizeof(TarZeros));
+    return(OutClose(&Archive));
+}
+
+// Write the generated output files. Returns the number written.
+int WriteOutputs(Job *J)
+{
+    Empire *E = J->E;
+    const EmpireOutput *Output;
+    OutFile Out;
+    double Start;
+    int o, i, Written = 0;
+
+    if (TarOutput) {
+#ifndef _WIN32
+        pthread_mutex_lock(&ArchiveLock);
+#endif
+        for (o=0; o<EmpireNumOutputs(E); o++) {
+            Output = EmpireGetOutput(E, o);
+            Start = EmpireClock();
+            if (ArchiveOutput(J, Output) == 0) {
+                Written++;
+                if (ReportIO) {
+                    Report(J, "Archived %s: %lu bytes\n", Output->FileName, (unsigned long)Output->Len);
+                }
+            }
+            if (TraceFile != NULL) {
+                AddTraceEvent(J, Output->FileName, "write", 0, Output->Line, Start, EmpireClock());
+            }
         }
+        // The pieces go away with the data file.
+        OutFlush(&Archive);
+#ifndef _WIN32
+        pthread_mutex_unlock(&ArchiveLock);
+#endif
+        return(Written);
     }
-    exit(NumErrors);
+    for (o=0; o<EmpireNumOutputs(E); o++) {
+        Output = EmpireGetOutput(E, o);
+        if (Output->Skip) {
+            if (ReportIO) {
+                Report(J, "Unchanged %s\n", Output->FileName);
+            }
+            continue;
+        }
+        if (Incremental) {
+            Report(J, "Rebuilding %s\n", Output->FileName);
+        }
+        Start = EmpireClock();
+        if (OutOpen(&Out, Output->FileName) != 0) {
+            Report(J, "Error: line %d: can't open the output file\n", Output->Line);
+            J->NumErrors++;
+            continue;
+        }
+        for (i=0; i<Output->NumPieces; i++) {
+            OutWrite(&Out, Output->Pieces[i].Ptr, Output->Pieces[i].Len);
+        }
+        Written++;
+        if (OutClose(&Out) != 0) {
+            Report(J, "Error: line %d: can't write the output file\n", Output->Line);
+            J->NumErrors++;
+        }
+        if (ReportIO) {
+            Report(J, "Wrote %s: %lld bytes in %d writes\n", Output->FileName, Out.Bytes, Out.Syscalls);
+        }
+        if (Compact && Output->FullLen > 0) {
+            Report(J, "Compacted %s: %lu -> %lu bytes (%.1f%% smaller)\n", Output->FileName,
+                   (unsigned long)Output->FullLen, (unsigned long)Output->Len,
+                   100.0 * (double)(Output->FullLen - Output->Len) / (double)Output->FullLen);
+        }
+        if (TraceFile != NULL) {
+            AddTraceEvent(J, Output->FileName, "write", 0, Output->Line, Start, EmpireClock());
+        }
+    }
+    return(Written);
 }
 
+// Incremental mode (-i). The hashes of the files written are kept in a cache
+// file next to the data file, and on the next run only the files whose hash
+// changed (or that have gone missing) are generated and written again. Each
+// line of the cache is the hash of a file, in hex, and the file name.
+void LoadCache(Empire *E, const char *CacheName)
+{
+    const EmpireOutput *Output;
+    struct stat Info;
+    char Line[1024];
+    unsigned long long Hash;
+    FILE *fp;
+    int o, Len;
 
-// Helper functions for generating the output events.
-// Externals used: FILE *ofp, char TagArray[][], char StringArray[][],
-// int RNGCTag, int EventIDPrefix, int EventData[][], ProvinceEventIndex[],
-// char ProvinceNames[][]
+    fp = fopen(CacheName, "r");
+    if (fp == NULL) {
+        // No cache yet, write everything.
+        return;
+    }
+    while (fgets(Line, sizeof(Line), fp) != NULL) {
+        Len = (int)strlen(Line);
+        while (Len > 0 && (Line[Len - 1] == '\n' || Line[Len - 1] == '\r')) {
+            Line[--Len] = 0;
+        }
+        if (Len < 18 || Line[16] != ' ' || sscanf(Line, "%16llx", &Hash) != 1) {
+            continue;
+        }
+        for (o=0; o<EmpireNumOutputs(E); o++) {
+            Output = EmpireGetOutput(E, o);
+            if (!Output->Skip && Output->Hash == Hash && strcmp(Output->FileName, Line + 17) == 0 &&
+                stat(Output->FileName, &Info) == 0) {
+                EmpireSkipOutput(E, o);
+            }
+        }
+    }
+    fclose(fp);
+}
 
-// Not sure exactly how this works in the EU II engine, but I think each
-// month is 30 days (even february somehow) and each year thus 360 days.
-// Calculate using that assumption and subtract a few days to be on the
-// safe side regarding spans starting or ending in february. (This is used
-// for calculating the event offset, making it slightly too small is no
-// problem, making it too large may result in CTDs.)
-int CalcDateSpan(int Start, int End)
+void SaveCache(Job *J, const char *CacheName)
 {
-    int y1, y2, m1, m2, d1, d2;
-
-    d1 = Start % 100;
-    Start = Start / 100;
-    m1 = Start % 100;
-    y1 = Start / 100;
-    Start = y1 * 360 + (m1 - 1) * 30 + (d1 - 1);
-    d2 = End % 100;
-    End = End / 100;
-    m2 = End % 100;
-    y2 = End / 100;
-    End = y2 * 360 + (m2 - 1) * 30 + (d2 - 1);
-    return(End - Start - 6);
+    Empire *E = J->E;
+    const EmpireOutput *Output;
+    FILE *fp;
+    int o;
+
+    fp = fopen(CacheName, "w");
+    if (fp == NULL) {
+        Report(J, "Warning: can't write the cache file %s\n", CacheName);
+        J->NumWarnings++;
+        return;
+    }
+    for (o=0; o<EmpireNumOutputs(E); o++) {
+        Output = EmpireGetOutput(E, o);
+        fprintf(fp, "%016llx %s\n", Output->Hash, Output->FileName);
+    }
+    fclose(fp);
 }
 
-// Event IDs are built up by concatenating the prefix number + a four digit
-// number for the province ID + a two digit running number for the events
-// used for that province. Example: with the prefix = 717 (as in the original
-// mod), the first event used for province 302 (Hinterpommern in vanilla)
-// would be 717030200, the next 717030201 etc.
-int GenerateEventID(int ProvinceID, int Event)
+// With -i the province names are also saved in a compiled index next to the
+// province file (province.csv.empidx), which later runs with -i map and use
+// instead as long as province.csv keeps the same size and time stamp.
+static InputFile ProvinceIndex; // Holds the names in use, if HaveProvinceIndex.
+static int HaveProvinceIndex = 0;
+
+// The modification time of a file, as precisely as we can get it, so that
+// an edit keeping the size within the same second still shows.
+long long FileMTime(const char *FileName, const struct stat *Info)
 {
-    int ID;
+#if defined(_WIN32)
+    WIN32_FILE_ATTRIBUTE_DATA Data;
 
-    if (ProvinceEventIndex[Event][ProvinceID] > 99) {
-        Error("too many events generated", 0);
-        return(INT_MAX);
+    // In 100 ns units.
+    if (GetFileAttributesExA(FileName, GetFileExInfoStandard, &Data)) {
+        return((long long)(((unsigned long long)Data.ftLastWriteTime.dwHighDateTime << 32) |
+                           Data.ftLastWriteTime.dwLowDateTime));
     }
-    ID = EventIDPrefix * 1000000 + ProvinceID * 100 + Event * 10 + ProvinceEventIndex[Event][ProvinceID];
-    ProvinceEventIndex[Event][ProvinceID]++;
-    return(ID);
+    return((long long)Info->st_mtime);
+#else
+    (void)FileName;
+    // Where struct stat has the times as timespecs, st_mtime is a macro for
+    // their seconds. Otherwise (e.g. with -std=c99) whole seconds will do.
+#if defined(__APPLE__) && defined(st_mtime)
+    return((long long)Info->st_mtimespec.tv_sec * 1000000000LL + Info->st_mtimespec.tv_nsec);
+#elif defined(st_mtime)
+    return((long long)Info->st_mtim.tv_sec * 1000000000LL + Info->st_mtim.tv_nsec);
+#else
+    return((long long)Info->st_mtime * 1000000000LL);
+#endif
+#endif
 }
 
-char *ModIDFormat = "\
-event = {\n\
-	id = %d\n\
-	random = no\n\
-	province = %d\n\
-	name = \"EVENTNAME%d\" #%s\n\
-	desc = \"%s\"\n\
-	action = {\n\
-		name = \"OK\"\n\
-		command = { %s } #%s\n\
-	}\n\
-}\n\n";
-
-char *GenFormat = "\
-# %s\n\
-event = {\n\
-	id = %d\n\
-	trigger = {\n\
-%s\
-%s\
-	}\n\
-	random = no\n\
-	country = %s\n\
-	name = \"AI_EVENT\"\n\
-	desc = \"%d\"\n\
-	date = { %s }\n\
-	offset = %d\n\
-	deathdate = { %s }\n\
-	action = {\n\
-		name = \"OK\"\n\
-		ai_chance = %d\n\
-		command = { type = trigger which = %d }\n\
-	}\n\
-	action = {\n\
-		name = \"OK\"\n\
-		ai_chance = %d\n\
-		command = { }\n\
-	}\n\
-}\n\n";
-
-// When the user selects AI event choices as Historical, the AI always chooses the first option.
-// To be prepared for that case, provinces with a lower chance of conversion should have the Convert option second.
-char *GenLowChanceFormat = "\
-# %s\n\
-event = {\n\
-	id = %d\n\
-	trigger = {\n\
-%s\
-%s\
-	}\n\
-	random = no\n\
-	country = %s\n\
-	name = \"AI_EVENT\"\n\
-	desc = \"%d\"\n\
-	date = { %s }\n\
-	offset = %d\n\
-	deathdate = { %s }\n\
-	action = {\n\
-		name = \"OK\"\n\
-		ai_chance = %d\n\
-		command = { }\n\
-	}\n\
-	action = {\n\
-		name = \"OK\"\n\
-		ai_chance = %d\n\
-		command = { type = trigger which = %d }\n\
-	}\n\
-}\n\n";
-
-char *Gen100pFormat = "\
-# %s\n\
-event = {\n\
-    id = %d\n\
-    trigger = {\n\
-%s\
-%s\
-    }\n\
-    random = no\n\
-    country = %s\n\
-    name = \"AI_EVENT\"\n\
-    desc = \"%d\"\n\
-    date = { %s }\n\
-    offset = %d\n\
-    deathdate = { %s }\n\
-    action = {\n\
-        name = \"OK\"\n\
-        # Convert\n\
-        command = { type = trigger which = %d }\n\
-    }\n\
-}\n\n";
-
-const char *StrMonth[] = {
-    NULL, "january", "february", "march", "april", "may", "june", "july",
-    "august", "september", "october", "november", "december"
-};
+// Replace a file, writing a new file and renaming it so that a mapped old
+// file is left alone (and a failed write doesn't lose it). Returns 0 on
+// success.
+int ReplaceFile(const char *FileName, const char *Buf, size_t Len)
+{
+    char *TempName;
+    FILE *fp;
+    int Failed;
 
-// Temporary arrays used during event generation.
-// Make these a bit larger than the base strings in order to allow for some
-// reasonable increase when doing the '%d' and '%s' expansions. (Say, a long
-// province name multiplied a few times.)
-static char StrExpName[MAX_STRING_LENGTH + 3 * MAX_PROVINCENAME_LENGTH];
-static char StrExpDesc[MAX_STRING_LENGTH + 3 * MAX_PROVINCENAME_LENGTH];
-static char StrExpCommand[MAX_STRING_LENGTH + 3 * MAX_PROVINCENAME_LENGTH];
-static char StrExpTrigger[MAX_STRING_LENGTH + 40];
-static char StrSmallFlag[MAX_TAG_LENGTH + 30];
-static char StrNormalFlag[MAX_TAG_LENGTH + 30];
-static char StrLargeFlag[MAX_TAG_LENGTH + 30];
-static char StrNotSmallFlag[MAX_TAG_LENGTH + 40];
-static char StrNotNormalFlag[MAX_TAG_LENGTH + 40];
-static char StrNotLargeFlag[MAX_TAG_LENGTH + 50];
-static char StrStartDate[40];
-static char StrEndDate[40];
-
-char *PickFlagStr(int Small, int Normal, int Large, int Target)
+    TempName = MemAlloc(strlen(FileName) + 5);
+    sprintf(TempName, "%s.tmp", FileName);
+    fp = fopen(TempName, "wb");
+    Failed = fp == NULL;
+    if (fp != NULL) {
+        Failed = fwrite(Buf, 1, Len, fp) != Len;
+        Failed |= fclose(fp) != 0;
+#ifdef _WIN32
+        remove(FileName);
+#endif
+        Failed = Failed || rename(TempName, FileName) != 0;
+        if (Failed) {
+            remove(TempName);
+        }
+    }
+    free(TempName);
+    return(Failed ? -1 : 0);
+}
+
+// Replace the province index.
+void SaveProvinceIndex(Job *J, const char *IndexName, long long Size, long long MTime)
 {
-    int NumS = 0, NumN = 0, NumL = 0;
+    char *Buf;
+    size_t Len;
 
-    // Shared only if different versions have the same probability.
-    if (Small == Target) {
-        NumS = 1;
+    Buf = EmpireSaveProvinceIndex(J->E, Size, MTime, &Len);
+    // Not being able to save it only makes the next run slower.
+    if (ReplaceFile(IndexName, Buf, Len) != 0) {
+        Report(J, "Warning: can't write the province index %s\n", IndexName);
+        J->NumWarnings++;
     }
-    if (Normal == Target) {
-        NumN = 1;
+    free(Buf);
+}
+
+// The event ID registry (--ids): which data file owns each event ID, kept
+// from run to run, so a data file generating IDs another one has is caught
+// even when they are compiled separately.
+static EmpireIDRegistry *Registry = NULL;
+
+void LoadRegistry(const char *FileName)
+{
+    InputFile In;
+
+    Registry = EmpireCreateIDRegistry();
+    if (OpenInput(&In, FileName) != 0) {
+        // No registry yet.
+        return;
     }
-    if (Large == Target) {
-        NumL = 1;
+    if (EmpireLoadIDRegistry(Registry, In.Buf, In.Size) != 0) {
+        fprintf(stderr, "Warning: %s isn't an event ID registry, starting a new one\n", FileName);
+        NumWarnings++;
     }
+    CloseInput(&In);
+}
+
+void SaveRegistry(const char *FileName)
+{
+    char *Buf;
+    size_t Len;
 
-    if (NumS > 0 && NumN > 0 && NumL > 0) {
-        // All, no flag needed here.
-        return("");
+    Buf = EmpireSaveIDRegistry(Registry, &Len);
+    if (ReplaceFile(FileName, Buf, Len) != 0) {
+        fprintf(stderr, "Warning: can't write the event ID registry %s\n", FileName);
+        NumWarnings++;
     }
-    if (NumS > 0 && NumN > 0) {
-        // All except Large.
-        return(StrNotLargeFlag);
+    free(Buf);
+}
+
+// Read province.csv, for the province names. Returns 0 on success.
+int LoadProvinceFile(Job *J, const char *FileName)
+{
+    InputFile In, Index;
+    struct stat Info;
+    char *IndexName;
+    double Start = EmpireClock();
+    int Errors, HaveInfo;
+
+    IndexName = MemAlloc(strlen(FileName) + 8);
+    sprintf(IndexName, "%s.empidx", FileName);
+    // The index is only used and kept up to date with -i.
+    HaveInfo = Incremental && stat(FileName, &Info) == 0;
+    if (HaveInfo && OpenInput(&Index, IndexName) == 0) {
+        if (EmpireLoadProvinceIndex(J->E, Index.Buf, Index.Size, (long long)Info.st_size,
+                                    FileMTime(FileName, &Info)) == 0) {
+            Report(J, "Using province index %s\n", IndexName);
+            // The old names aren't used any more.
+            if (HaveProvinceIndex) {
+                CloseInput(&ProvinceIndex);
+            }
+            ProvinceIndex = Index;
+            HaveProvinceIndex = 1;
+            free(IndexName);
+            EndPhase(J, PHASE_PROVINCES, Start);
+            return(0);
+        }
+        // Stale or not an index, make a new one.
+        CloseInput(&Index);
     }
-    if (NumS > 0 && NumL > 0) {
-        // All except Normal.
-        return(StrNotNormalFlag);
+    if (OpenInput(&In, FileName) != 0) {
+        Report(J, "Failed to open province file %s\n", FileName);
+        J->NumErrors++;
+        free(IndexName);
+        return(-1);
     }
-    if (NumN > 0 && NumL > 0) {
-        // All except Small.
-        return(StrNotSmallFlag);
+    Report(J, "Parsing province file %s\n", FileName);
+    Errors = EmpireLoadProvinces(J->E, FileName, In.Buf, In.Size);
+    CloseInput(&In);
+    if (HaveProvinceIndex) {
+        CloseInput(&ProvinceIndex);
+        HaveProvinceIndex = 0;
     }
-    if (NumS > 0) {
-        // Only small.
-        return(StrSmallFlag);
+    if (Errors == 0 && HaveInfo) {
+        SaveProvinceIndex(J, IndexName, (long long)Info.st_size, FileMTime(FileName, &Info));
     }
-    if (NumN > 0) {
-        // Only Normal.
-        return(StrNormalFlag);
+    free(IndexName);
+    EndPhase(J, PHASE_PROVINCES, Start);
+    return(Errors > 0 ? -1 : 0);
+}
+
+// The file name part of Path.
+const char *BaseName(const char *Path)
+{
+    const char *Slash = strrchr(Path, '/');
+#ifdef _WIN32
+    const char *Backslash = strrchr(Path, '\\');
+
+    if (Backslash != NULL && (Slash == NULL || Backslash > Slash)) {
+        Slash = Backslash;
+    }
+#endif
+    return(Slash != NULL ? Slash + 1 : Path);
+}
+
+// Checking the mod's own events (--events DIR): every file in the directory
+// is scanned for event IDs, the files spread over the -j threads, and any ID
+// the data file generates too is an error, so that nothing gets written.
+// The output files of the data file are skipped, in case they go there.
+typedef struct {
+    char *Path;
+    EmpireEventRef *Refs;
+    int NumRefs;
+    int Failed;
+} EventFile;
+
+typedef struct {
+    EventFile *Files;
+    int NumFiles;
+    int Next;                  // The next file to scan.
+#ifndef _WIN32
+    pthread_mutex_t Lock;
+#endif
+} EventScan;
+
+int CompareEventFiles(const void *a, const void *b)
+{
+    return(strcmp(((const EventFile *)a)->Path, ((const EventFile *)b)->Path));
+}
+
+// Add the regular files in Dir (sorted by name) to Scan.
+int ListEventFiles(EventScan *Scan, const char *Dir)
+{
+    char *Path;
+    int Size = 0;
+#ifndef _WIN32
+    struct dirent *Entry;
+    struct stat Info;
+    DIR *d;
+
+    d = opendir(Dir);
+    if (d == NULL) {
+        return(-1);
+    }
+    while ((Entry = readdir(d)) != NULL) {
+        Path = MemAlloc(strlen(Dir) + strlen(Entry->d_name) + 2);
+        sprintf(Path, "%s/%s", Dir, Entry->d_name);
+        if (stat(Path, &Info) != 0 || !S_ISREG(Info.st_mode)) {
+            free(Path);
+            continue;
+        }
+#else
+    WIN32_FIND_DATAA Entry;
+    HANDLE h;
+
+    Path = MemAlloc(strlen(Dir) + 3);
+    sprintf(Path, "%s\\*", Dir);
+    h = FindFirstFileA(Path, &Entry);
+    free(Path);
+    if (h == INVALID_HANDLE_VALUE) {
+        return(-1);
     }
-    if (NumL > 0) {
-        // Only Large.
-        return(StrLargeFlag);
+    do {
+        if (Entry.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) {
+            continue;
+        }
+        Path = MemAlloc(strlen(Dir) + strlen(Entry.cFileName) + 2);
+        sprintf(Path, "%s\\%s", Dir, Entry.cFileName);
+#endif
+        if (Scan->NumFiles >= Size) {
+            Size = Size > 0 ? Size * 2 : 256;
+            Scan->Files = realloc(Scan->Files, Size * sizeof(EventFile));
+            if (Scan->Files == NULL) {
+                fprintf(stderr, "Out of memory\n");
+                exit(EXIT_FAILURE);
+            }
+        }
+        memset(&Scan->Files[Scan->NumFiles], 0, sizeof(EventFile));
+        Scan->Files[Scan->NumFiles++].Path = Path;
+#ifndef _WIN32
+    }
+    closedir(d);
+#else
+    } while (FindNextFileA(h, &Entry));
+    FindClose(h);
+#endif
+    qsort(Scan->Files, Scan->NumFiles, sizeof(EventFile), CompareEventFiles);
+    return(0);
+}
+
+void ScanEventFiles(EventScan *Scan)
+{
+    EventFile *File;
+    InputFile In;
+    int i;
+
+    while (1) {
+#ifndef _WIN32
+        pthread_mutex_lock(&Scan->Lock);
+#endif
+        i = Scan->Next++;
+#ifndef _WIN32
+        pthread_mutex_unlock(&Scan->Lock);
+#endif
+        if (i >= Scan->NumFiles) {
+            return;
+        }
+        File = &Scan->Files[i];
+        if (File->Failed != 0) {
+            // Left out.
+            continue;
+        }
+        if (OpenInput(&In, File->Path) != 0) {
+            File->Failed = 1;
+            continue;
+        }
+        File->Refs = EmpireScanEventIDs(In.Buf, In.Size, &File->NumRefs);
+        CloseInput(&In);
     }
-    // No events for this target.
+}
+
+#ifndef _WIN32
+static void *ScanThread(void *Arg)
+{
+    ScanEventFiles(Arg);
     return(NULL);
 }
+#endif
+
+void CheckEventDir(Job *J, const char *Dir)
+{
+    const EventFile *File;
+    EventScan Scan;
+    int i, o, r, Line, NumIDs = 0, Conflicts = 0, Skip;
+#ifndef _WIN32
+    pthread_t *Threads;
+    int *Started;
+#endif
+
+    memset(&Scan, 0, sizeof(Scan));
+    if (ListEventFiles(&Scan, Dir) != 0) {
+        Report(J, "Error: can't read the event directory %s\n", Dir);
+        J->NumErrors++;
+        return;
+    }
+    // Leave out the files the data file writes.
+    for (i=0; i<Scan.NumFiles; i++) {
+        for (o=0; o<EmpireNumOutputs(J->E); o++) {
+            if (strcmp(BaseName(Scan.Files[i].Path), BaseName(EmpireGetOutput(J->E, o)->FileName)) == 0) {
+                Scan.Files[i].Failed = -1;
+            }
+        }
+    }
+#ifndef _WIN32
+    pthread_mutex_init(&Scan.Lock, NULL);
+    Threads = MemAlloc(NumThreads * sizeof(pthread_t));
+    Started = MemAlloc(NumThreads * sizeof(int));
+    for (i=1; i<NumThreads; i++) {
+        Started[i] = pthread_create(&Threads[i], NULL, ScanThread, &Scan) == 0;
+    }
+    ScanEventFiles(&Scan);
+    for (i=1; i<NumThreads; i++) {
+        if (Started[i]) {
+            pthread_join(Threads[i], NULL);
+        }
+    }
+    free(Threads);
+    free(Started);
+    pthread_mutex_destroy(&Scan.Lock);
+#else
+    ScanEventFiles(&Scan);
+#endif
+    for (i=0; i<Scan.NumFiles; i++) {
+        File = &Scan.Files[i];
+        Skip = File->Failed;
+        if (Skip > 0) {
+            Report(J, "Warning: can't read the event file %s\n", File->Path);
+            J->NumWarnings++;
+        }
+        for (r=0; Skip == 0 && r<File->NumRefs; r++) {
+            Line = EmpireEventIDLine(J->E, File->Refs[r].ID);
+            if (Line > 0) {
+                Report(J, "Error: line %d: event ID %d is also used in %s, line %d\n", Line,
+                       File->Refs[r].ID, File->Path, File->Refs[r].Line);
+                J->NumErrors++;
+                Conflicts++;
+            }
+        }
+        NumIDs += File->NumRefs;
+        free(File->Refs);
+        free(File->Path);
+    }
+    if (ReportIO || Conflicts > 0) {
+        Report(J, "Checked %d event IDs in %d files in %s, %d used by the data file\n", NumIDs,
+               Scan.NumFiles, Dir, Conflicts);
+    }
+    free(Scan.Files);
+}
 
-// Function for outputting the events for a Modification.
-// Currently we only support a limited set of probability numbers.
-// Note that some numbers will generate a larger number of events than
-// others, and it might be a good idea to keep the total number of events
-// to a reasonable level... (That said, nothing prevents you from generating
-// several modifications for the same EventData.)
-// The currently supported probabilities are shown in the table below.
-// The events line refers to the implementation: 5p = an event with 5%
-// probability etc, '*' = multiple independent events, '->' = cascading events.
-// Index:       0 1   2   3    4     5     6         7           8    9   10  11  12
-// Probability: 0 5  10  15   28    39    48        61          72    85  90  95  100
-// Events       - 5p 10p 15p 2*15p 3*15p 4*15p 85p->85p->85p 85p->85p 85p 90p 95p 100p
-void OutputEvents(int ProvinceID, int Event, int Trigger, int StartDate, int EndDate,
-                  int Small, int Normal, int Large)
+// Both phases for the data file. Sets J->Written to the number of files
+// written, and J->NumOutputs to the number of output files.
+void CompileDataFile(Job *J)
 {
-    int ModID, ID1, ID2, ID3, Target;
-    char *FlagStr;
+    Empire *E = J->E;
+    InputFile In;
+    const EmpireSpan *Span;
+    char *CacheName = NULL;
+    double Start = EmpireClock();
+    int i;
 
-    // Check that we actually have something to do...
-    if (Small == 0 && Normal == 0 && Large == 0) {
+    J->Written = J->NumOutputs = 0;
+    J->OverlapsLen = 0;
+    if ((strcmp(J->FileName, "-") == 0 ? ReadStdin(&In) : OpenInput(&In, J->FileName)) != 0) {
+        Report(J, "Failed to open data file %s\n", J->FileName);
+        J->NumErrors++;
         return;
     }
-    // Do the '%s' and '%d' replacements on the argument strings.
-    // Name: allow a maximum of three instances of '%s' (replaced by province name).
-    sprintf(StrExpName, StringArray[EventData[Event][1]], ProvinceNames[ProvinceID],
-            ProvinceNames[ProvinceID], ProvinceNames[ProvinceID]);
-    // Description: allow a maximum of three instances of '%s' (replaced by province name).
-    sprintf(StrExpDesc, StringArray[EventData[Event][2]], ProvinceNames[ProvinceID],
-            ProvinceNames[ProvinceID], ProvinceNames[ProvinceID]);
-    // Command: allow a maximum of three instances of '%d' (replaced by province id number).
-    sprintf(StrExpCommand, StringArray[EventData[Event][3]], ProvinceID, ProvinceID, ProvinceID);
-    // Trigger: allow a maximum of 10 instances of '%d' (replaced by province id number).
-    sprintf(StrExpTrigger, StringArray[Trigger], ProvinceID, ProvinceID,
-            ProvinceID, ProvinceID, ProvinceID, ProvinceID, ProvinceID,
-            ProvinceID, ProvinceID, ProvinceID);
-    // Change any occurance of feb 29 or feb 30 to mar 1.
-    if (StartDate % 10000 == 229 || StartDate % 10000 == 230) {
-        StartDate = (StartDate / 10000) * 10000 + 301;
-    }
-    if (EndDate % 10000 == 229 || EndDate % 10000 == 230) {
-        EndDate = (EndDate / 10000) * 10000 + 301;
-    }
-    // Convert the dates to EU II format event date strings.
-    sprintf(StrStartDate, "year = %d month = %s day = %d", StartDate / 10000,
-            StrMonth[(StartDate / 100) % 100], StartDate % 100);
-    sprintf(StrEndDate, "year = %d month = %s day = %d", EndDate / 10000,
-            StrMonth[(EndDate / 100) % 100], EndDate % 100);
-    // Generate the actual modification event.
-    ModID = GenerateEventID(ProvinceID, Event);
-    fprintf(omfp, ModIDFormat,
-            ModID, ProvinceID, ModID, StrExpName, StrExpDesc, StrExpCommand, ProvinceNames[ProvinceID]);
-    // Generate Small/Normal/Large flag strings.
-    sprintf(StrSmallFlag,     "\t\tflag = Small%s\n",  TagArray[EventData[Event][0]]);
-    sprintf(StrNormalFlag,    "\t\tflag = Normal%s\n", TagArray[EventData[Event][0]]);
-    sprintf(StrLargeFlag,     "\t\tflag = Large%s\n",  TagArray[EventData[Event][0]]);
-    sprintf(StrNotSmallFlag,  "\t\tNOT = { flag = Small%s }\n",  TagArray[EventData[Event][0]]);
-    sprintf(StrNotNormalFlag, "\t\tNOT = { flag = Normal%s }\n", TagArray[EventData[Event][0]]);
-    sprintf(StrNotLargeFlag,  "\t\tNOT = { flag = Large%s }\n",  TagArray[EventData[Event][0]]);
-    // Generate the RNGC events.
-    for (Target=1; Target<=100; Target++) {
-        FlagStr = PickFlagStr(Small, Normal, Large, Target);
-        if (FlagStr == NULL) {
-            // Nothing for this target.
+    Report(J, "Parsing data file %s\n", J->FileName);
+    // Generation phase, only if everything is fine so far.
+    EmpireParse(E, J->FileName, In.Buf, In.Size);
+    if (OverlapFile != NULL && EmpireNumErrors(E) == 0) {
+        FindOverlaps(J);
+    }
+    if (EventDir != NULL && EmpireNumErrors(E) == 0) {
+        CheckEventDir(J, EventDir);
+    }
+    Start = EndPhase(J, PHASE_PARSE, Start);
+    if (SimTrials > 0 && EmpireNumErrors(E) == 0) {
+        // Not part of any phase.
+        Simulate(J);
+        Start = EmpireClock();
+    }
+    if (EmpireNumErrors(E) == 0 && J->NumErrors == 0) {
+        if (Incremental) {
+            // The cache lives next to the data file.
+            CacheName = MemAlloc(strlen(J->FileName) + 7);
+            sprintf(CacheName, "%s.cache", J->FileName);
+            LoadCache(E, CacheName);
+            Start = EndPhase(J, PHASE_CACHE, Start);
+        }
+        EmpireGenerate(E);
+        Start = EndPhase(J, PHASE_GENERATE, Start);
+        for (i=0; i<EmpireNumSpans(E); i++) {
+            Span = EmpireGetSpan(E, i);
+            AddTraceEvent(J, Span->FileName, "render", Span->Thread, Span->Line, Span->Start, Span->End);
+        }
+        J->Written = WriteOutputs(J);
+        J->NumOutputs = EmpireNumOutputs(E);
+        if (Incremental && J->NumErrors == 0) {
+            SaveCache(J, CacheName);
+        }
+        free(CacheName);
+        EndPhase(J, PHASE_WRITE, Start);
+        if (ShowStats) {
+            PrintStats(J);
+        }
+    } else {
+        Report(J, "Not writing any output because of errors\n");
+    }
+    memset(J->PhaseTimes, 0, sizeof(J->PhaseTimes));
+    // The outputs point into the input, so forget them first.
+    EmpireReset(E);
+    CloseInput(&In);
+}
+
+#ifndef _WIN32
+static void *CompileThread(void *Arg)
+{
+    CompileDataFile(Arg);
+    return(NULL);
+}
+#endif
+
+// Compile all the data files, at the same time if there are several.
+void CompileAll(void)
+{
+    int i;
+#ifndef _WIN32
+    pthread_t *Threads;
+    int *Started;
+
+    if (NumJobs > 1) {
+        Threads = MemAlloc(NumJobs * sizeof(pthread_t));
+        Started = MemAlloc(NumJobs * sizeof(int));
+        for (i=0; i<NumJobs; i++) {
+            Jobs[i].Buffered = 1;
+            Started[i] = pthread_create(&Threads[i], NULL, CompileThread, &Jobs[i]) == 0;
+            if (!Started[i]) {
+                // Do it here instead.
+                CompileDataFile(&Jobs[i]);
+            }
+        }
+        for (i=0; i<NumJobs; i++) {
+            if (Started[i]) {
+                pthread_join(Threads[i], NULL);
+            }
+            FlushLog(&Jobs[i]);
+        }
+        free(Threads);
+        free(Started);
+        return;
+    }
+#endif
+    for (i=0; i<NumJobs; i++) {
+        CompileDataFile(&Jobs[i]);
+    }
+}
+
+// Watch mode (--watch): stay resident and compile the data file again
+// whenever it or the province file is saved. The province file is only read
+// again when it has changed. On Linux the directories holding the two files
+// are watched with inotify (editors often save by writing a new file and
+// renaming it, so watching the files themselves isn't enough), elsewhere
+// their size and time stamp are polled twice a second.
+#define WATCH_DATA_FILE     1
+#define WATCH_PROVINCE_FILE 2
+
+typedef struct {
+    const char *Path;
+    int What;
+    off_t Size;
+    time_t MTime;
+} WatchedFile;
+
+// Returns which of the files have changed since the last call.
+int PollFiles(WatchedFile *Files, int NumFiles)
+{
+    struct stat Info;
+    int i, Changed = 0;
+
+    for (i=0; i<NumFiles; i++) {
+        if (stat(Files[i].Path, &Info) != 0) {
+            // Probably in the middle of being saved.
+            continue;
+        }
+        if (Info.st_size != Files[i].Size || Info.st_mtime != Files[i].MTime) {
+            Files[i].Size = Info.st_size;
+            Files[i].MTime = Info.st_mtime;
+            Changed |= Files[i].What;
+        }
+    }
+    return(Changed);
+}
+
+void SleepMS(int MS)
+{
+#ifdef _WIN32
+    Sleep(MS);
+#else
+    struct timespec t;
+
+    t.tv_sec = MS / 1000;
+    t.tv_nsec = (long)(MS % 1000) * 1000000L;
+    nanosleep(&t, NULL);
+#endif
+}
+
+#ifdef __linux__
+// Add an inotify watch for the directory of Path. Returns -1 on failure.
+int WatchDirectory(int fd, const char *Path)
+{
+    const char *Slash = strrchr(Path, '/');
+    char *Dir;
+    int Ret;
+
+    if (Slash == NULL) {
+        return(inotify_add_watch(fd, ".", IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE));
+    }
+    Dir = MemAlloc(Slash - Path + 2);
+    memcpy(Dir, Path, Slash - Path + 1);
+    Dir[Slash - Path + 1] = 0;
+    Ret = inotify_add_watch(fd, Dir, IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE);
+    free(Dir);
+    return(Ret);
+}
+
+// Returns which of the files the events read into Buf are about.
+int MatchEvents(const char *Buf, ssize_t Len, WatchedFile *Files, int NumFiles)
+{
+    const struct inotify_event *Event;
+    const char *p;
+    int i, Changed = 0;
+
+    for (p=Buf; p<Buf+Len; p+=sizeof(struct inotify_event) + Event->len) {
+        Event = (const struct inotify_event *)p;
+        if (Event->len == 0) {
+            continue;
+        }
+        for (i=0; i<NumFiles; i++) {
+            if (strcmp(Event->name, BaseName(Files[i].Path)) == 0) {
+                Changed |= Files[i].What;
+            }
+        }
+    }
+    return(Changed);
+}
+
+// Wait until one of the files is saved, and return which. Events arriving
+// shortly after are collected too, since a save may take several writes.
+int WaitForEvents(int fd, WatchedFile *Files, int NumFiles)
+{
+    union {
+        struct inotify_event Align;
+        char Buf[4096];
+    } u;
+    struct pollfd p;
+    ssize_t Len;
+    int Changed = 0;
+
+    p.fd = fd;
+    p.events = POLLIN;
+    while (Changed == 0) {
+        if (poll(&p, 1, -1) <= 0) {
+            continue;
+        }
+        Len = read(fd, u.Buf, sizeof(u.Buf));
+        if (Len > 0) {
+            Changed |= MatchEvents(u.Buf, Len, Files, NumFiles);
+        }
+    }
+    while (poll(&p, 1, 20) > 0) {
+        Len = read(fd, u.Buf, sizeof(u.Buf));
+        if (Len > 0) {
+            Changed |= MatchEvents(u.Buf, Len, Files, NumFiles);
+        }
+    }
+    return(Changed);
+}
+#endif
+
+void Watch(Job *J, const char *ProvinceFile)
+{
+    const char *DataFile = J->FileName;
+    WatchedFile Files[2];
+    int Changed;
+#ifdef __linux__
+    int fd;
+
+    fd = inotify_init();
+    if (fd >= 0 && (WatchDirectory(fd, ProvinceFile) < 0 || WatchDirectory(fd, DataFile) < 0)) {
+        close(fd);
+        fd = -1;
+    }
+    if (fd < 0) {
+        fprintf(stderr, "Can't use inotify, checking the files twice a second instead\n");
+    }
+#endif
+
+    Files[0].Path = ProvinceFile;
+    Files[0].What = WATCH_PROVINCE_FILE;
+    Files[1].Path = DataFile;
+    Files[1].What = WATCH_DATA_FILE;
+    Files[0].Size = Files[1].Size = -1;
+    (void)PollFiles(Files, 2);
+    fprintf(stderr, "Watching %s and %s for changes, press Ctrl-C to stop\n", ProvinceFile, DataFile);
+    while (1) {
+#ifdef __linux__
+        if (fd >= 0) {
+            Changed = WaitForEvents(fd, Files, 2);
+        } else
+#endif
+        {
+            SleepMS(500);
+            Changed = PollFiles(Files, 2);
+        }
+        if (Changed == 0) {
             continue;
         }
-        ID1 = GenerateEventID(ProvinceID, Event);
-		if (Target == 100)
-			fprintf(ofp, Gen100pFormat, ProvinceNames[ProvinceID], ID1,
-					StrExpTrigger, FlagStr, TagArray[RNGCTag], ID1, StrStartDate,
-					CalcDateSpan(StartDate, EndDate), StrEndDate, ModID);
-		else if (Target <= LOW_CHANCE_THRESHOLD)
-			fprintf(ofp, GenLowChanceFormat, ProvinceNames[ProvinceID], ID1,
-				StrExpTrigger, FlagStr, TagArray[RNGCTag], ID1, StrStartDate,
-				CalcDateSpan(StartDate, EndDate), StrEndDate, 100 - Target, Target, ModID);
-		else
-			fprintf(ofp, GenFormat, ProvinceNames[ProvinceID], ID1,
-					StrExpTrigger, FlagStr, TagArray[RNGCTag], ID1, StrStartDate,
-					CalcDateSpan(StartDate, EndDate), StrEndDate, Target, ModID, 100-Target);
+        J->NumErrors = J->NumWarnings = 0;
+        ClearTrace(J);
+        if (Changed & WATCH_PROVINCE_FILE) {
+            if (LoadProvinceFile(J, ProvinceFile) != 0) {
+                fprintf(stderr, "Execution completed with %d errors and %d warnings\n", J->NumErrors, J->NumWarnings);
+                continue;
+            }
+        }
+        CompileDataFile(J);
+        if (RegistryFile != NULL) {
+            SaveRegistry(RegistryFile);
+        }
+        if (TraceFile != NULL) {
+            WriteTrace();
+        }
+        if (OverlapFile != NULL) {
+            WriteOverlaps();
+        }
+        fprintf(stderr, "Execution completed with %d errors and %d warnings, %d of %d output files changed\n",
+                J->NumErrors, J->NumWarnings, J->Written, J->NumOutputs);
     }
 }
 
 int main(int argc, char* argv[])
 {
-    int ProvinceFileIndex = -1, DataFileIndex = -1, HaltOnExit = 0;
-    int Char, Ret, i, j;
-    int Num, Num2, Num3, Num4, Num5, Num6;
-    int TagID, TagID2, TagID3, TagID4, TagID5;
-    int Str, Str2, Str3, Str4;
-    
-    // Initialize keyword tags.
-    strcpy(TagArray[TAG_FILE_ID],        "ProvinceModificationDataFile");
-    strcpy(TagArray[TAG_RNGC],           "RNGCTag");
-    strcpy(TagArray[TAG_EVENT_ID_PREFIX],"EventIDPrefix");
-    strcpy(TagArray[TAG_OUTPUT_FILE],    "OutputFile");
-    strcpy(TagArray[TAG_SET_STRING],     "SetString");
-    strcpy(TagArray[TAG_TARGET_STRING],  "TargetString");
-    strcpy(TagArray[TAG_START_CONDITION],"StartCondition");
-    strcpy(TagArray[TAG_EVENT_DATA],     "EventData");
-    strcpy(TagArray[TAG_MODIFICATION],   "Modification");
-    strcpy(TagArray[TAG_END_OF_DATA],    "EndOfData");
-	strcpy(TagArray[TAG_OUTPUT_FILE_MOD],"OutputFileMod");
-	strcpy(TagArray[TAG_OUTPUT_FILE_MOD_HEADER], "OutputFileModHeader");
+    int ProvinceFileIndex = -1, HaltOnExit = 0;
+    int WatchMode = 0, FromStdin = 0;
+    int i;
+
     // Parse the arguments.
     for (i=1; i<argc; i++) {
-        if (argv[i][0] == '-') {
-            if (argv[i][1] == 'h') {
+        // A lone "-" is the data file from stdin, not an option.
+        if (argv[i][0] == '-' && argv[i][1] != 0) {
+            if (strcmp(argv[i], "--watch") == 0) {
+                // Implies -i, so that only the changed files are written.
+                WatchMode = 1;
+                Incremental = 1;
+            } else if (strcmp(argv[i], "--stats") == 0) {
+                ShowStats = 1;
+            } else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc) {
+                TraceFile = argv[++i];
+            } else if (strcmp(argv[i], "--ids") == 0 && i + 1 < argc) {
+                RegistryFile = argv[++i];
+            } else if (strcmp(argv[i], "--overlaps") == 0 && i + 1 < argc) {
+                OverlapFile = argv[++i];
+            } else if (strcmp(argv[i], "--events") == 0 && i + 1 < argc) {
+                EventDir = argv[++i];
+            } else if (strcmp(argv[i], "--simulate") == 0 && i + 1 < argc) {
+                SimTrials = atoll(argv[++i]);
+            } else if (strcmp(argv[i], "--tar") == 0) {
+                TarOutput = 1;
+            } else if (argv[i][1] == 'h') {
                 // Lazy: consider any option beginning with '-h' as '-h'.
                 HaltOnExit = 1;
             } else if (argv[i][1] == 'H') {
                 // Lazy: consider any option beginning with '-H' as '-H'.
                 HaltOnExit = 2;
+            } else if (argv[i][1] == 'v') {
+                ReportIO = 1;
+            } else if (argv[i][1] == 'i') {
+                Incremental = 1;
+            } else if (argv[i][1] == 'c') {
+                Compact = 1;
+            } else if (argv[i][1] == 'j') {
+                // Number of threads, either -jN or -j N. 0 means one per CPU.
+                if (argv[i][2] != 0) {
+                    NumThreads = atoi(&argv[i][2]);
+                } else if (i + 1 < argc) {
+                    NumThreads = atoi(argv[++i]);
+                } else {
+                    NumThreads = -1;
+                }
+                if (NumThreads == 0) {
+#ifndef _WIN32
+                    NumThreads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+                    if (NumThreads < 1) {
+                        NumThreads = 1;
+                    }
+                }
+                if (NumThreads < 0) {
+                    fprintf(stderr, "Usage: %s [-h|H] [-v] [-i] [-c] [-j N] [--watch] [--stats] [--trace file] [--ids file] [--overlaps file] [--simulate N] [--events dir] [--tar] <province file> <data file>...\n", argv[0]);
+                    NumErrors++;
+                    Quit(HaltOnExit);
+                }
             } else {
                 // Unknown option.
-                fprintf(stderr, "Usage: %s [-h|H] <province file> <data file>\n", argv[0]);
+                fprintf(stderr, "Usage: %s [-h|H] [-v] [-i] [-c] [-j N] [--watch] [--stats] [--trace file] [--ids file] [--overlaps file] [--simulate N] [--events dir] [--tar] <province file> <data file>...\n", argv[0]);
                 NumErrors++;
                 Quit(HaltOnExit);
             }
@@ -668,400 +1708,108 @@ int main(int argc, char* argv[])
             if (ProvinceFileIndex < 0) {
                 // First non-option argument should be the province file.
                 ProvinceFileIndex = i;
-            } else if (DataFileIndex < 0) {
-                // Second non-option argument should be the data file.
-                DataFileIndex = i;
             } else {
-                // Too many non-option arguments.
-                fprintf(stderr, "Usage: %s [-h|H] <province file> <data file>\n", argv[0]);
-                NumErrors++;
-                Quit(HaltOnExit);
+                // The rest are data files.
+                if (Jobs == NULL) {
+                    Jobs = calloc(argc, sizeof(Job));
+                    if (Jobs == NULL) {
+                        fprintf(stderr, "Out of memory\n");
+                        exit(EXIT_FAILURE);
+                    }
+                }
+                if (strcmp(argv[i], "-") == 0) {
+                    FromStdin++;
+                }
+                Jobs[NumJobs++].FileName = argv[i];
             }
         }
     }
     // Check for the required arguments.
-    if (ProvinceFileIndex < 0 || DataFileIndex < 0) {
-        fprintf(stderr, "Usage: %s [-h|H] <province file> <data file>\n", argv[0]);
+    if (ProvinceFileIndex < 0 || NumJobs == 0) {
+        fprintf(stderr, "Usage: %s [-h|H] [-v] [-i] [-c] [-j N] [--watch] [--stats] [--trace file] [--ids file] [--overlaps file] [--simulate N] [--events dir] [--tar] <province file> <data file>...\n", argv[0]);
         NumErrors++;
         Quit(HaltOnExit);
     }
-    
-    // Open the province file.
-    ifp = fopen(argv[ProvinceFileIndex], "r");
-    if (ifp == NULL) {
-        fprintf(stderr, "Failed to open province file %s\n", argv[ProvinceFileIndex]);
+    if (WatchMode && NumJobs > 1) {
+        fprintf(stderr, "--watch only works with one data file\n");
         NumErrors++;
         Quit(HaltOnExit);
     }
-    LineNumber = 1;
-    // Start parsing province file.
-    fprintf(stderr, "Parsing province file %s\n", argv[ProvinceFileIndex]);
-    if (GetChar() == 'I' && GetChar() == 'd' && GetChar() == ';' &&
-        GetChar() == 'N' && GetChar() == 'a' && GetChar() == 'm' &&
-        GetChar() == 'e' && GetChar() == ';') {
-        // Looks like a province.csv file.
-        SkipRestOfLine();
-        while (1) {
-            Num = GetNum();
-            if (Num == -1) {
-                // End marker.
-                break;
-            }
-            if (Num < 0 || Num >= MAX_PROVINCES) {
-                Error("province ID out of range, aborting", 0);
-                Quit(HaltOnExit);
-            }
-            Char = GetChar();
-            if ((char)Char != ';') {
-                Error("expected ';'", Char);
-                UnGetChar(Char);
-            }
-            i = 0;
-            while (1) {
-                Char = GetChar();
-                if ((char)Char == ';') {
-                    // End of field.
-                    break;
-                }
-                if (i >= MAX_PROVINCENAME_LENGTH) {
-                    Warning("province name too long, truncating", 0);
-                    break;
-                } else {
-                    ProvinceNames[Num][i] = (char)Char;
-                    i++;
-                }
-            }
-            // Null terminate.
-            ProvinceNames[Num][i] = 0;
-            if (Num > LargestProvinceID) {
-                if (Num >= MAX_PROVINCES) {
-                    Error("too high province ID", 0);
-                    Quit(HaltOnExit);
-                }
-                LargestProvinceID = Num;
-            }
-            SkipRestOfLine();
-        }
-    } else {
-        fprintf(stderr, "the province file doesn't look like an EU II province.csv file");
+    if (FromStdin > 1) {
+        fprintf(stderr, "Only one data file can be read from stdin\n");
         NumErrors++;
         Quit(HaltOnExit);
     }
-    // All done with the province file.
-    fclose(ifp);
-
-    // Open data file.
-    ifp = fopen(argv[DataFileIndex], "r");
-    if (ifp == NULL) {
-        fprintf(stderr, "Failed to open data file %s\n", argv[DataFileIndex]);
+    // Both need the output files on disk, and a data file to read again.
+    if (Incremental && TarOutput) {
+        fprintf(stderr, "-i and --watch can't be used with --tar\n");
         NumErrors++;
         Quit(HaltOnExit);
     }
-    LineNumber = 1;
-    // Start parsing data file.
-    fprintf(stderr, "Parsing data file %s\n", argv[DataFileIndex]);
-    TagID = GetTag();
-    // Verify the file ID tag.
-    if (TagID != TAG_FILE_ID) {
-        Error("expected the ProvinceModificationDataFile tag", 0);
+    if (Incremental && FromStdin) {
+        fprintf(stderr, "-i and --watch can't be used with a data file from stdin\n");
+        NumErrors++;
         Quit(HaltOnExit);
     }
-    TagID = GetTag();
-    while (1) {
-        switch (TagID) {
-            case TAG_FILE_ID:
-                Warning("spurious ProvinceModificationDataFile tag", 0);
-                break;
-            case TAG_RNGC:
-                VerifyListStart();
-                RNGCTag = GetTag();
-                VerifyListEnd();
-                // We ought to verify that it's a valid EU II country tag.
-                break;
-            case TAG_EVENT_ID_PREFIX:
-                VerifyListStart();
-                Num = GetNum();
-                VerifyListEnd();
-                // Not sure what the exact requirements for the event numbers
-                // are, but to be on the safe side, make them positive numbers
-                // fitting a signed 32-bit integer, and stay clear of the
-                // lowest range. With the event numbering scheme used, we
-                // need six digits for ourselves.
-                if (Num < 1 || Num > 2146) {
-                    Error("EventIDPrefix argument outside [1..2146]", 0);
-                } else {
-                    EventIDPrefix = Num;
-                }
-                break;
-            case TAG_OUTPUT_FILE:
-                VerifyListStart();
-                Ret = GetString();
-                VerifyListEnd();
-                ofp = NULL;
-                if (Ret == 0) {
-                    // Close the old one, if any.
-                    if (ofp != NULL) {
-                        fclose(ofp);
-                    }
-                    // Try to open the file for writing.
-                    ofp = fopen(LatestString, "w+");
-                }
-                if (ofp == NULL) {
-                    Error("can't open the output file", 0);
-                }
-                break;
-			case TAG_OUTPUT_FILE_MOD:
-                VerifyListStart();
-                Ret = GetString();
-                VerifyListEnd();
-                omfp = NULL;
-                if (Ret == 0) {
-                    // Close the old one, if any.
-                    if (omfp != NULL) {
-                        fclose(omfp);
-                    }
-                    // Try to open the file for writing.
-                    omfp = fopen(LatestString, "w+");
-					// Write the header
-					fprintf(omfp, "%s", OutputFileModHeader);
-                }
-                if (omfp == NULL) {
-                    Error("can't open the output file", 0);
-                }
-                break;
-			case TAG_OUTPUT_FILE_MOD_HEADER:
-                VerifyListStart();
-                Ret = GetString();
-                VerifyListEnd();
-                if (Ret == 0) {
-					strcpy(OutputFileModHeader, LatestString);
-                } else {
-                    Error("no valid string to set as header", 0);
-                }
-                break;
-            case TAG_SET_STRING:
-                VerifyListStart();
-                TagID2 = GetTag();
-                Ret = GetString();
-                VerifyListEnd();
-                if (TagID2 >= 0 && TagID2 < TAG_FIRST_USER_TAG) {
-                    Error("can't SetString a keyword tag", 0);
-                }
-                if (TagID2 >= TAG_FIRST_USER_TAG && TagID2 < TagIndex && Ret == 0) {
-                    if (StringIndex >= MAX_STRINGS) {
-                        Error("too many strings defined", 0);
-                    } else {
-                        // Valid user tag and string.
-                        strcpy(StringArray[StringIndex], LatestString);
-                        UserStringsIndexArray[StringIndex] = TagID2;
-                        StringIndex++;
-                    }
-                }
-                break;
-            case TAG_TARGET_STRING:
-                VerifyListStart();
-                Ret = GetString();
-                VerifyListEnd();
-                if (Ret == 0) {
-                    if (ofp != NULL) {
-                        fprintf(ofp, "%s", LatestString);
-                    } else {
-                        Error("no valid output file", 0);
-                    }
-                } else {
-                    Error("no valid string to output", 0);
-                }
-                break;
-            case TAG_START_CONDITION:
-                VerifyListStart();
-                Num = GetNum();
-                TagID2 = GetTag();
-                VerifyListEnd();
-                // Verify it for being a valid province (based on province.csv).
-                if (Num <= 0 || Num > LargestProvinceID) {
-                    Error("not a valid province", 0);
-                }
-                // Check that the tag refers to a string set by the user.
-                for (Str=0; Str<StringIndex; Str++) {
-                    if (UserStringsIndexArray[Str] == TagID2) {
-                        // Found it.
-                        break;
-                    }
-                }
-                if (Str >= StringIndex) {
-                    Error("undefined tag", 0);
-                }
-                if (ofp != NULL) {
-                    if (Num > 0 && Num <= LargestProvinceID && Str < StringIndex) {
-                        fprintf(ofp, "province = { id = %d %s }\n", Num, StringArray[Str]);
-                    }
-                } else {
-                    Error("no valid output file", 0);
-                }
-                break;
-            case TAG_EVENT_DATA:
-                VerifyListStart();
-                TagID2 = GetTag();
-                TagID3 = GetTag();
-                TagID4 = GetTag();
-                TagID5 = GetTag();
-                VerifyListEnd();
-                if (TagID2 >= 0 && TagID2 < TAG_FIRST_USER_TAG) {
-                    Error("can't define a keyword tag", 0);
-                }
-                // Check that the tag doesn't refer to a string set by the user.
-                for (Str=0; Str<StringIndex; Str++) {
-                    if (UserStringsIndexArray[Str] == TagID2) {
-                        // Found it.
-                        break;
-                    }
-                }
-                if (Str < StringIndex) {
-                    Error("tag already used for a string", 0);
-                }
-                // Check that the tag refers to a string set by the user.
-                for (Str2=0; Str2<StringIndex; Str2++) {
-                    if (UserStringsIndexArray[Str2] == TagID3) {
-                        // Found it.
-                        break;
-                    }
-                }
-                if (Str2 >= StringIndex) {
-                    Error("undefined name tag", 0);
-                }
-                // Check that the tag refers to a string set by the user.
-                for (Str3=0; Str3<StringIndex; Str3++) {
-                    if (UserStringsIndexArray[Str3] == TagID4) {
-                        // Found it.
-                        break;
-                    }
-                }
-                if (Str3 >= StringIndex) {
-                    Error("undefined description tag", 0);
-                }
-                // Check that the tag refers to a string set by the user.
-                for (Str4=0; Str4<StringIndex; Str4++) {
-                    if (UserStringsIndexArray[Str4] == TagID5) {
-                        // Found it.
-                        break;
-                    }
-                }
-                if (Str4 >= StringIndex) {
-                    Error("undefined command tag", 0);
-                }
-                if (TagID2 >= TAG_FIRST_USER_TAG && TagID2 < TagIndex &&
-                    Str >= StringIndex && Str2 < StringIndex &&
-                    Str3 < StringIndex && Str4 < StringIndex) {
-                    if (EventDataIndex < MAX_EVENT_DATA) {
-                        EventData[EventDataIndex][0] = TagID2;
-                        EventData[EventDataIndex][1] = Str2;
-                        EventData[EventDataIndex][2] = Str3;
-                        EventData[EventDataIndex][3] = Str4;
-                        EventDataIndex++;
-                    } else {
-                        Error("too many EventData definitions", 0);
-                    }
-                }
-                break;
-            case TAG_MODIFICATION:
-                VerifyListStart();
-                Num = GetNum();
-                TagID2 = GetTag();
-                TagID3 = GetTag();
-                Num2 = GetDate();
-                Num3 = GetDate();
-                Num4 = GetNum();
-                Num5 = GetNum();
-                Num6 = GetNum();
-                VerifyListEnd();
-                // Verify it for being a valid province (based on province.csv).
-                if (Num <= 0 || Num > LargestProvinceID) {
-                    Error("not a valid province", 0);
-                }
-                // Check that we have a valid EventData.
-                for (i=0; i<EventDataIndex; i++) {
-                    if (EventData[i][0] == TagID2) {
-                        // Found it.
-                        break;
-                    }
-                }
-                if (i >= EventDataIndex) {
-                    Error("not a valid EventData", 0);
-                }
-                // Check that the tag refers to a string set by the user.
-                for (j=0; j<StringIndex; j++) {
-                    if (UserStringsIndexArray[j] == TagID3) {
-                        // Found it.
-                        break;
-                    }
-                }
-                if (j >= StringIndex) {
-                    Error("undefined trigger tag", 0);
-                }
-                if (!VerifyDate(Num2)) {
-                    Error("invalid start date", 0);
-                }
-                if (!VerifyDate(Num3)) {
-                    Error("invalid end date", 0);
-                }
-                if (Num2 > Num3) {
-                    Error("start date larger than end date", 0);
-                }
-                if (Num4 < 0 || Num4 > 100 ||
-                    Num5 < 0 || Num5 > 100 ||
-                    Num6 < 0 || Num6 > 100) {
-                    Error("probability outside [0..100]", 0);
-                }
-                if (RNGCTag == INT_MAX) {
-                    Error("undefined RNGCTag, aborting", 0);
-                    Quit(HaltOnExit);
-                }
-                if (EventIDPrefix == INT_MAX) {
-                    Error("undefined EventIDPrefix, aborting", 0);
-                    Quit(HaltOnExit);
-                }
-                if (ofp != NULL) {
-                    if (Num > 0 && Num <= LargestProvinceID &&
-                        i < EventDataIndex && j < StringIndex &&
-                        VerifyDate(Num2) && VerifyDate(Num3) && Num2 <= Num3 &&
-                        Num4 >= 0 && Num4 <= 100 &&
-                        Num5 >= 0 && Num5 <= 100 &&
-                        Num6 >= 0 && Num6 <= 100) {
-                        OutputEvents(Num, i, j, Num2, Num3, Num4, Num5, Num6);
-                    }
-                } else {
-                    Error("no valid output file", 0);
-                }
-                break;
-            case TAG_END_OF_DATA:
-                // All done, but check for any spurios data.
-                SkipWhitespacesAndComments();
-                Char = GetChar();
-                if (Char != EOF) {
-                    Warning("ignoring spurious data after EndOfData tag", Char);
-                }
-                Quit(HaltOnExit);
-                break;
-            case INT_MAX:
-                // Not a tag.
-                Error("not a valid tag", 0);
-                Char = GetChar();
-                if (Char == EOF) {
-                    Error("end of file before EndOfdata tag", 0);
-                    Quit(HaltOnExit);
-                } else {
-                    UnGetChar(Char);
-                }
-                break;
-            default:
-                // User tag.
-                Error("not a keyword tag", 0);
-                break;
-        }
-        if (NumErrors > 50) {
-            Error("too many errors, aborting", 0);
-            Quit(HaltOnExit);
-        }
-        TagID = GetTag();
+
+    TraceStart = EmpireClock();
+    if (RegistryFile != NULL) {
+        LoadRegistry(RegistryFile);
+    }
+    for (i=0; i<NumJobs; i++) {
+        Jobs[i].E = EmpireCreate();
+        EmpireSetDiagnosticHandler(Jobs[i].E, PrintDiagnostic, &Jobs[i]);
+        EmpireSetThreads(Jobs[i].E, NumThreads);
+        EmpireSetCompact(Jobs[i].E, Compact);
+        EmpireSetTracing(Jobs[i].E, TraceFile != NULL);
+        EmpireSetIDRegistry(Jobs[i].E, Registry);
     }
+    // The province file is read once, the data files share the names.
+    if (LoadProvinceFile(&Jobs[0], argv[ProvinceFileIndex]) != 0) {
+        NumErrors += Jobs[0].NumErrors;
+        NumWarnings += Jobs[0].NumWarnings;
+        Quit(HaltOnExit);
+    }
+    for (i=1; i<NumJobs; i++) {
+        EmpireSetProvinces(Jobs[i].E, EmpireGetProvinces(Jobs[0].E));
+    }
+    if (TarOutput) {
+        OpenArchive();
+    }
+    CompileAll();
+    if (TarOutput && CloseArchive() != 0) {
+        fprintf(stderr, "Failed to write the tar archive to stdout\n");
+        NumErrors++;
+    }
+    if (RegistryFile != NULL) {
+        SaveRegistry(RegistryFile);
+    }
+    if (TraceFile != NULL) {
+        WriteTrace();
+    }
+    if (OverlapFile != NULL) {
+        WriteOverlaps();
+    }
+    if (WatchMode) {
+        fprintf(stderr, "Execution completed with %d errors and %d warnings\n", Jobs[0].NumErrors, Jobs[0].NumWarnings);
+        Watch(&Jobs[0], argv[ProvinceFileIndex]);
+    }
+    for (i=0; i<NumJobs; i++) {
+        NumErrors += Jobs[i].NumErrors;
+        NumWarnings += Jobs[i].NumWarnings;
+        ClearTrace(&Jobs[i]);
+        free(Jobs[i].TraceEvents);
+        free(Jobs[i].Log);
+        free(Jobs[i].Overlaps);
+        EmpireDestroy(Jobs[i].E);
+    }
+    free(Jobs);
+    if (Registry != NULL) {
+        EmpireDestroyIDRegistry(Registry);
+    }
+    if (HaveProvinceIndex) {
+        CloseInput(&ProvinceIndex);
+    }
+    Quit(HaltOnExit);
+    return(0);
 }
@@ -0,0 +1,258 @@
+/*
+   This file contains the source code for the EU2 modding tool Alun's Empire
+   (Enhanced Modification of Province Information with Randomizing Events.)
+
+   Copyright (C) 2006 alun
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License along
+   with this program; if not, write to the Free Software Foundation, Inc.,
+   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+
+// Alun's Empire as a library, for front ends that want to regenerate the
+// events without running Empire.exe. Everything lives in an Empire context;
+// the inputs are passed in as buffers and the generated files are handed
+// back as buffers, so nothing is read from or written to disk and nothing
+// calls exit() (except on running out of memory).
+//
+// Usage:
+//     E = EmpireCreate();
+//     EmpireLoadProvinces(E, "province.csv", ProvinceBuf, ProvinceLen);
+//     if (EmpireParse(E, "FTG.empire", DataBuf, DataLen) == 0 &&
+//         EmpireGenerate(E) >= 0) {
+//         for (i=0; i<EmpireNumOutputs(E); i++) {
+//             ... EmpireGetOutput(E, i) ...
+//         }
+//     }
+//     EmpireReset(E); // Before the next EmpireParse.
+//     ...
+//     EmpireDestroy(E);
+//
+// A context must only be used by one thread at a time, but different
+// contexts can be used from different threads. The input buffers have to
+// stay around until the context is reset or destroyed, since the outputs
+// point into them.
+
+#ifndef EMPIRE_H
+#define EMPIRE_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct Empire Empire;
+typedef struct EmpireProvinces EmpireProvinces;
+typedef struct EmpireIDRegistry EmpireIDRegistry;
+
+// Diagnostic severities.
+#define EMPIRE_ERROR    0
+#define EMPIRE_WARNING  1
+
+typedef struct {
+    int Severity;         // EMPIRE_ERROR or EMPIRE_WARNING.
+    const char *FileName; // The input it's about.
+    int Line;
+    const char *Message;  // Includes the offending character, if any.
+} EmpireDiagnostic;
+
+typedef void (*EmpireDiagnosticHandler)(void *User, const EmpireDiagnostic *Diag);
+
+// A piece of an output file.
+typedef struct {
+    const char *Ptr;
+    size_t Len;
+} EmpirePiece;
+
+// One output file. The list of output files is known after EmpireParse, the
+// contents after EmpireGenerate.
+typedef struct {
+    const char *FileName;       // As given in the data file.
+    int IsMod;                  // OutputFileMod rather than OutputFile.
+    int Line;                   // Of the OutputFile or OutputFileMod.
+    unsigned long long Hash;    // Of everything the contents depend on.
+    int Skip;                   // Not to be generated, see EmpireSkipOutput.
+    const EmpirePiece *Pieces;  // The contents, one piece after the other.
+    int NumPieces;
+    size_t Len;                 // The total length of the pieces.
+    size_t FullLen;             // What Len would be without EmpireSetCompact.
+} EmpireOutput;
+
+// Two Modifications changing a province at the same time, see
+// EmpireFindOverlaps. The dates are YYYYMMDD, and the end dates are included.
+typedef struct {
+    int ProvinceID;
+    int Line1, Line2;           // The Modifications, the one starting first first.
+    const char *EventData1;     // Their EventData tags.
+    const char *EventData2;
+    int Conflict;               // Different EventData, rather than the same twice.
+    int Start1, End1;
+    int Start2, End2;
+} EmpireOverlap;
+
+// The chance that a province converts, for one EventData, with each of the
+// Small/Normal/Large flags set (indexed 0..2), see EmpireSimulate.
+typedef struct {
+    int ProvinceID;
+    const char *EventData;      // The EventData tag.
+    const char *FileName;       // The OutputFile of its (first) RNGC events.
+    int NumModifications;       // Of the province with the EventData.
+    long long Trials;
+    double Expected[3];         // From the percentages in the data file.
+    double Rate[3];             // Simulated, with Random AI event choices.
+    double Error[3];            // The 95% confidence interval is Rate +- Error.
+    double Historical[3];       // With Historical AI event choices (0 or 1).
+} EmpireSimResult;
+
+// An event ID found in an event file, see EmpireScanEventIDs.
+typedef struct {
+    int ID;
+    int Line;
+} EmpireEventRef;
+
+Empire *EmpireCreate(void);
+void EmpireDestroy(Empire *E);
+
+// Diagnostics are collected in the context, and also passed to Handler (if
+// set) as they are found.
+void EmpireSetDiagnosticHandler(Empire *E, EmpireDiagnosticHandler Handler, void *User);
+// The number of threads EmpireGenerate renders the events with (default 1).
+void EmpireSetThreads(Empire *E, int NumThreads);
+// Compact output: the rendered events without comments and indentation, and
+// each top level event on one line. Only the events generated from the
+// Modifications are compacted, the rest of an output is as written. Set it
+// before EmpireParse, as the output hashes depend on it.
+void EmpireSetCompact(Empire *E, int On);
+
+// Read the province names from a province.csv file. Returns the number of
+// errors. The names are kept by EmpireReset.
+int EmpireLoadProvinces(Empire *E, const char *FileName, const char *Buf, size_t Len);
+// A compiled index of the province names loaded, so later runs can skip
+// reading province.csv. Size and MTime identify the province.csv (e.g. its
+// size and modification time), an index is only used for the same values.
+// Returns a malloc:ed buffer, and its length in *Len.
+char *EmpireSaveProvinceIndex(Empire *E, long long Size, long long MTime, size_t *Len);
+// Use the names in an index made by EmpireSaveProvinceIndex. The names are
+// used straight from Buf, so it has to stay around as long as they are (by
+// any context sharing them). Returns 0 on success, or -1 if Buf isn't a
+// valid index for Size and MTime.
+int EmpireLoadProvinceIndex(Empire *E, const char *Buf, size_t Len, long long Size, long long MTime);
+// The province names can be shared by several contexts, they are read only
+// once loaded. EmpireSetProvinces makes E use the names of another context
+// (the names stay around until no context uses them).
+EmpireProvinces *EmpireGetProvinces(Empire *E);
+void EmpireSetProvinces(Empire *E, EmpireProvinces *Provinces);
+
+// The event IDs a data file generates must not overlap, neither with each
+// other nor with the IDs of other data files of the same mod. The overlaps
+// within a data file are always errors. An ID registry records which data
+// file owns each ID, so that the other data files (compiled at the same time
+// or in other runs) get an error for any ID it already has. The data files
+// are known by the FileName given to EmpireParse, and a data file's IDs are
+// replaced with the new ones each time it's parsed without errors. The
+// registry can be shared by contexts compiling at the same time, but has to
+// stay around as long as they use it.
+EmpireIDRegistry *EmpireCreateIDRegistry(void);
+void EmpireDestroyIDRegistry(EmpireIDRegistry *R);
+void EmpireSetIDRegistry(Empire *E, EmpireIDRegistry *R);
+// The registry as text, to be loaded by a later run. Returns a malloc:ed
+// buffer, and its length in *Len.
+char *EmpireSaveIDRegistry(EmpireIDRegistry *R, size_t *Len);
+// Add the IDs in a saved registry. Returns 0 on success, or -1 if Buf isn't
+// a saved registry (leaving R empty).
+int EmpireLoadIDRegistry(EmpireIDRegistry *R, const char *Buf, size_t Len);
+
+// Parse and check a data file, and assign the event IDs. Returns the number
+// of errors; if there are any, nothing can be generated.
+int EmpireParse(Empire *E, const char *FileName, const char *Buf, size_t Len);
+
+int EmpireNumOutputs(Empire *E);
+const EmpireOutput *EmpireGetOutput(Empire *E, int i);
+// Don't generate output i, e.g. because its Hash says it hasn't changed.
+void EmpireSkipOutput(Empire *E, int i);
+
+// Find the pairs of Modifications (that generate anything) whose date
+// windows overlap for the same province: the same EventData twice, or two
+// competing ones such as Protestant and Reformed. Call after EmpireParse.
+// Returns the number of overlaps, sorted by province and start date.
+int EmpireFindOverlaps(Empire *E);
+const EmpireOverlap *EmpireGetOverlap(Empire *E, int i);
+
+// Checking the event IDs against those of other events (e.g. the events
+// of the mod). EmpireEventIDLine returns the line of the Modification that
+// generates event ID, or 0 if none does (after EmpireParse).
+// EmpireScanEventIDs finds the event IDs in an event file, returned in a
+// malloc:ed array with their number in *Num.
+int EmpireEventIDLine(Empire *E, int ID);
+EmpireEventRef *EmpireScanEventIDs(const char *Buf, size_t Len, int *Num);
+
+// Run the RNGC events generated for each province and EventData Trials
+// times (using the threads set with EmpireSetThreads), to check that they
+// convert with the chances given in the data file. The Modifications are
+// taken to be independent, their triggers to hold, and the events to use
+// the default option order. Call after EmpireParse. Returns the number of
+// results, sorted by province and EventData; they are the same whatever the
+// number of threads.
+int EmpireSimulate(Empire *E, long long Trials);
+const EmpireSimResult *EmpireGetSimResult(Empire *E, int i);
+
+// Render the contents of the outputs not skipped. Returns the number of
+// outputs generated, or -1 if the data file had errors.
+int EmpireGenerate(Empire *E);
+// The contents of an output in one malloc:ed, null terminated buffer.
+char *EmpireJoinOutput(const EmpireOutput *Output);
+
+// Forget the data file (and all diagnostics), keeping the province names
+// and settings.
+void EmpireReset(Empire *E);
+
+// Counters for the work done by the last EmpireParse and EmpireGenerate.
+typedef struct {
+    long long TagLookups;       // Tags looked up while parsing.
+    long long StringExpansions; // '%s'/'%d' expansions of SetStrings.
+    long long ExpansionCacheHits; // Expansions shared with an earlier Modification.
+    long long Modifications;    // Modifications rendered.
+    long long RNGCEvents;       // RNGC events emitted for them.
+    int MaxRNGCEvents;          // The most for one Modification.
+} EmpireStats;
+
+const EmpireStats *EmpireGetStats(Empire *E);
+
+// Tracing: when on, EmpireGenerate records how long each thread spent
+// rendering the Modifications of each OutputFile section. Kept by
+// EmpireReset.
+typedef struct {
+    const char *FileName; // Of the OutputFile.
+    int Line;             // Of the OutputFile.
+    int Thread;           // 0 is the thread calling EmpireGenerate.
+    double Start, End;    // EmpireClock times.
+} EmpireSpan;
+
+void EmpireSetTracing(Empire *E, int On);
+int EmpireNumSpans(Empire *E);
+const EmpireSpan *EmpireGetSpan(Empire *E, int i);
+// A monotonic clock, in microseconds from some fixed point.
+double EmpireClock(void);
+
+int EmpireNumErrors(Empire *E);
+int EmpireNumWarnings(Empire *E);
+int EmpireNumDiagnostics(Empire *E);
+const EmpireDiagnostic *EmpireGetDiagnostic(Empire *E, int i);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,338 @@
+/*
+   This file contains the source code for the EU2 modding tool Alun's Empire
+   (Enhanced Modification of Province Information with Randomizing Events.)
+
+   Copyright (C) 2006 alun
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License along
+   with this program; if not, write to the Free Software Foundation, Inc.,
+   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+// Benchmark for the Empire library. Generates a synthetic province.csv and
+// data file in memory, runs them through the library a number of times and
+// reports how long each phase took, as JSON on stdout:
+//     province_load  EmpireLoadProvinces
+//     parse          EmpireParse (lexing, parsing, checks, event IDs)
+//     render         EmpireGenerate
+//     write          writing the output files (with plain stdio)
+// Build it together with LibEmpire.c, e.g.
+//     gcc -O2 -o EmpireBench EmpireBench.c LibEmpire.c -lpthread
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdarg.h>
+#include "Empire.h"
+
+// The workload.
+static int NumProvinces = 8000;
+static int NumEvents = 4;           // EventData entries.
+static int NumModifications = 50000;
+static int Spread = 3;              // Distinct probabilities to pick from.
+static int NumFiles = 20;           // OutputFile/OutputFileMod pairs.
+static unsigned int Seed = 1;
+// How to run it.
+static int NumThreads = 1;
+static int Repeat = 5;
+static const char *OutDir = NULL;   // Where to write the outputs, NULL = don't.
+static const char *DumpDir = NULL;  // Where to save the generated inputs.
+
+#define NUM_PHASES 4
+static const char *PhaseNames[NUM_PHASES] = {
+    "province_load", "parse", "render", "write"
+};
+
+// A buffer that grows to fit whatever is formatted into it.
+typedef struct {
+    char *Ptr;
+    size_t Len, Size;
+} Text;
+
+static void TextPrintf(Text *t, const char *Format, ...)
+{
+    va_list Args;
+    int Len;
+
+    while (1) {
+        va_start(Args, Format);
+        Len = vsnprintf(t->Ptr + t->Len, t->Size - t->Len, Format, Args);
+        va_end(Args);
+        if (Len >= 0 && t->Len + Len < t->Size) {
+            t->Len += Len;
+            return;
+        }
+        t->Size = t->Size > 0 ? t->Size * 2 : 65536;
+        t->Ptr = realloc(t->Ptr, t->Size);
+        if (t->Ptr == NULL) {
+            fprintf(stderr, "Out of memory\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
+// Small, fast and the same everywhere, so a seed gives the same input on
+// all build boxes.
+static unsigned int Random(unsigned int *State)
+{
+    unsigned int x = *State;
+
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *State = x;
+    return(x);
+}
+
+static void MakeProvinceFile(Text *t)
+{
+    int i;
+
+    TextPrintf(t, "Id;Name;Color;\n");
+    for (i=1; i<=NumProvinces; i++) {
+        TextPrintf(t, "%d;Province%d;0;\n", i, i);
+    }
+    TextPrintf(t, "-1;;;\n");
+}
+
+// The Modifications go round robin over the provinces and the EventData,
+// so each (province, EventData) pair gets as few event IDs as possible.
+static void MakeDataFile(Text *t)
+{
+    unsigned int State = Seed != 0 ? Seed : 1;
+    int i, f, Prov, Event, Chance[3], k;
+
+    TextPrintf(t, "ProvinceModificationDataFile\n");
+    TextPrintf(t, "RNGCTag (MUS)\n");
+    TextPrintf(t, "EventIDPrefix (717)\n");
+    TextPrintf(t, "SetString (Trig \"\t\tNOT = { province_religion = { province = %%d type = protestant } }\n\")\n");
+    TextPrintf(t, "SetString (Cond \"religion = catholic\")\n");
+    for (i=0; i<NumEvents; i++) {
+        TextPrintf(t, "SetString (Name%d \"%%s converts (%d)\")\n", i, i);
+        TextPrintf(t, "SetString (Desc%d \"The people of %%s have had enough (%d).\")\n", i, i);
+        TextPrintf(t, "SetString (Cmd%d \"type = religion which = %%d value = protestant\")\n", i);
+        TextPrintf(t, "EventData (Ev%d Name%d Desc%d Cmd%d)\n", i, i, i, i);
+    }
+    for (f=0; f<NumFiles; f++) {
+        TextPrintf(t, "OutputFile (\"BenchRNGC%d.eue\")\n", f);
+        TextPrintf(t, "OutputFileMod (\"BenchMod%d.eue\")\n", f);
+        TextPrintf(t, "TargetString (\"# Generated by EmpireBench\n\")\n");
+        if (f == 0) {
+            for (i=1; i<=NumProvinces && i<=100; i++) {
+                TextPrintf(t, "StartCondition (%d Cond)\n", i);
+            }
+        }
+        for (i=(int)((long long)NumModifications * f / NumFiles);
+             i<(int)((long long)NumModifications * (f + 1) / NumFiles); i++) {
+            Prov = 1 + i % NumProvinces;
+            Event = (i / NumProvinces) % NumEvents;
+            for (k=0; k<3; k++) {
+                // Spread evenly spaced values over 1..100.
+                Chance[k] = Spread > 1 ? 1 + (int)(Random(&State) % Spread) * 99 / (Spread - 1) : 50;
+            }
+            TextPrintf(t, "Modification (%d Ev%d Trig 1520-01-01 1560-12-30 %d %d %d)\n",
+                       Prov, Event, Chance[0], Chance[1], Chance[2]);
+        }
+    }
+    TextPrintf(t, "EndOfData\n");
+}
+
+static void SaveText(const char *Dir, const char *Name, const Text *t)
+{
+    char Path[1024];
+    FILE *fp;
+
+    sprintf(Path, "%.900s/%s", Dir, Name);
+    fp = fopen(Path, "wb");
+    if (fp == NULL) {
+        fprintf(stderr, "Can't write %s\n", Path);
+        exit(EXIT_FAILURE);
+    }
+    fwrite(t->Ptr, 1, t->Len, fp);
+    fclose(fp);
+}
+
+static void PrintDiagnostic(void *User, const EmpireDiagnostic *Diag)
+{
+    (void)User;
+    fprintf(stderr, "%s: %s: line %d: %s\n", Diag->Severity == EMPIRE_ERROR ? "Error" : "Warning",
+            Diag->FileName, Diag->Line, Diag->Message);
+}
+
+// Write the generated outputs to OutDir. Returns the number of bytes.
+static size_t WriteOutputs(Empire *E)
+{
+    const EmpireOutput *Output;
+    char Path[1024];
+    size_t Bytes = 0;
+    FILE *fp;
+    int o, i;
+
+    for (o=0; o<EmpireNumOutputs(E); o++) {
+        Output = EmpireGetOutput(E, o);
+        sprintf(Path, "%.900s/%.100s", OutDir, Output->FileName);
+        fp = fopen(Path, "wb");
+        if (fp == NULL) {
+            fprintf(stderr, "Can't write %s\n", Path);
+            exit(EXIT_FAILURE);
+        }
+        for (i=0; i<Output->NumPieces; i++) {
+            fwrite(Output->Pieces[i].Ptr, 1, Output->Pieces[i].Len, fp);
+        }
+        fclose(fp);
+        Bytes += Output->Len;
+    }
+    return(Bytes);
+}
+
+static int CompareDoubles(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+
+    return(x < y ? -1 : x > y ? 1 : 0);
+}
+
+static void Usage(const char *Name)
+{
+    fprintf(stderr, "Usage: %s [-p provinces] [-e eventdata] [-m modifications] [-s spread]\n"
+                    "       [-f files] [-S seed] [-j threads] [-r repeat] [-o outdir] [-d dumpdir]\n"
+                    "At most 2 modifications per province and eventdata, e.g. -p 9999 -e 6 -m 100000\n", Name);
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char* argv[])
+{
+    Text ProvinceText, DataText;
+    Empire *E;
+    double *Times[NUM_PHASES], t0, Min, Sum;
+    size_t OutputBytes = 0;
+    EmpireStats Stats;
+    int i, r, p, Value, NumOutputs = 0, PerPair;
+
+    // Parse the arguments, all "-x N".
+    for (i=1; i<argc; i++) {
+        if (argv[i][0] != '-' || argv[i][1] == 0 || argv[i][2] != 0 || i + 1 >= argc) {
+            Usage(argv[0]);
+        }
+        Value = atoi(argv[i + 1]);
+        switch (argv[i][1]) {
+            case 'p': NumProvinces = Value; break;
+            case 'e': NumEvents = Value; break;
+            case 'm': NumModifications = Value; break;
+            case 's': Spread = Value; break;
+            case 'f': NumFiles = Value; break;
+            case 'S': Seed = (unsigned int)Value; break;
+            case 'j': NumThreads = Value; break;
+            case 'r': Repeat = Value; break;
+            case 'o': OutDir = argv[i + 1]; break;
+            case 'd': DumpDir = argv[i + 1]; break;
+            default: Usage(argv[0]);
+        }
+        i++;
+    }
+    if (NumProvinces < 1 || NumProvinces > 9999 || NumEvents < 1 || NumModifications < 0 ||
+        Spread < 1 || Spread > 100 || NumFiles < 1 || NumThreads < 1 || Repeat < 1) {
+        Usage(argv[0]);
+    }
+    // Each pair has room for 10 event IDs before running into the next
+    // EventData's, and a Modification takes up to 4.
+    PerPair = (NumModifications + NumProvinces * NumEvents - 1) / (NumProvinces * NumEvents);
+    if (PerPair * 4 > 10) {
+        fprintf(stderr, "Too many Modifications for the provinces and EventData (at most %d)\n",
+                NumProvinces * NumEvents * 2);
+        return(EXIT_FAILURE);
+    }
+
+    memset(&Stats, 0, sizeof(Stats));
+    memset(&ProvinceText, 0, sizeof(ProvinceText));
+    memset(&DataText, 0, sizeof(DataText));
+    MakeProvinceFile(&ProvinceText);
+    MakeDataFile(&DataText);
+    if (DumpDir != NULL) {
+        SaveText(DumpDir, "province.csv", &ProvinceText);
+        SaveText(DumpDir, "bench.empire", &DataText);
+    }
+
+    for (p=0; p<NUM_PHASES; p++) {
+        Times[p] = calloc(Repeat, sizeof(double));
+    }
+    for (r=0; r<Repeat; r++) {
+        E = EmpireCreate();
+        EmpireSetDiagnosticHandler(E, PrintDiagnostic, NULL);
+        EmpireSetThreads(E, NumThreads);
+        t0 = EmpireClock();
+        if (EmpireLoadProvinces(E, "province.csv", ProvinceText.Ptr, ProvinceText.Len) != 0) {
+            return(EXIT_FAILURE);
+        }
+        Times[0][r] = (EmpireClock() - t0) / 1000.0;
+        t0 = EmpireClock();
+        if (EmpireParse(E, "bench.empire", DataText.Ptr, DataText.Len) != 0) {
+            return(EXIT_FAILURE);
+        }
+        Times[1][r] = (EmpireClock() - t0) / 1000.0;
+        t0 = EmpireClock();
+        NumOutputs = EmpireGenerate(E);
+        Times[2][r] = (EmpireClock() - t0) / 1000.0;
+        OutputBytes = 0;
+        for (i=0; i<NumOutputs; i++) {
+            OutputBytes += EmpireGetOutput(E, i)->Len;
+        }
+        Stats = *EmpireGetStats(E);
+        if (OutDir != NULL) {
+            t0 = EmpireClock();
+            WriteOutputs(E);
+            Times[3][r] = (EmpireClock() - t0) / 1000.0;
+        }
+        EmpireDestroy(E);
+    }
+
+    printf("{\n");
+    printf("  \"provinces\": %d,\n", NumProvinces);
+    printf("  \"event_data\": %d,\n", NumEvents);
+    printf("  \"modifications\": %d,\n", NumModifications);
+    printf("  \"spread\": %d,\n", Spread);
+    printf("  \"files\": %d,\n", NumFiles);
+    printf("  \"seed\": %u,\n", Seed);
+    printf("  \"threads\": %d,\n", NumThreads);
+    printf("  \"repeat\": %d,\n", Repeat);
+    printf("  \"province_bytes\": %lu,\n", (unsigned long)ProvinceText.Len);
+    printf("  \"data_bytes\": %lu,\n", (unsigned long)DataText.Len);
+    printf("  \"outputs\": %d,\n", NumOutputs);
+    printf("  \"output_bytes\": %lu,\n", (unsigned long)OutputBytes);
+    printf("  \"tag_lookups\": %lld,\n", Stats.TagLookups);
+    printf("  \"string_expansions\": %lld,\n", Stats.StringExpansions);
+    printf("  \"expansion_cache_hits\": %lld,\n", Stats.ExpansionCacheHits);
+    printf("  \"rngc_events\": %lld,\n", Stats.RNGCEvents);
+    printf("  \"phases_ms\": {\n");
+    for (p=0; p<NUM_PHASES; p++) {
+        if (p == 3 && OutDir == NULL) {
+            continue;
+        }
+        Sum = 0;
+        for (r=0; r<Repeat; r++) {
+            Sum += Times[p][r];
+        }
+        qsort(Times[p], Repeat, sizeof(double), CompareDoubles);
+        Min = Times[p][0];
+        printf("    \"%s\": { \"min\": %.3f, \"median\": %.3f, \"mean\": %.3f }%s\n", PhaseNames[p],
+               Min, Times[p][Repeat / 2], Sum / Repeat, p < (OutDir != NULL ? 3 : 2) ? "," : "");
+    }
+    printf("  }\n");
+    printf("}\n");
+    for (p=0; p<NUM_PHASES; p++) {
+        free(Times[p]);
+    }
+    free(ProvinceText.Ptr);
+    free(DataText.Ptr);
+    return(0);
+}
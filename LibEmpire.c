@@ -0,0 +1,3965 @@
+/*
+   This file contains the source code for the EU2 modding tool Alun's Empire
+   (Enhanced Modification of Province Information with Randomizing Events.)
+
+   Copyright (C) 2006 alun
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License along
+   with this program; if not, write to the Free Software Foundation, Inc.,
+   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+// clock_gettime is POSIX, glibc only declares it with -std=c99 if asked to.
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <stdarg.h>
+#include <time.h>
+#include <math.h>
+#ifndef _WIN32
+#include <pthread.h>
+#endif
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#endif
+#include "Empire.h"
+
+#define LOW_CHANCE_THRESHOLD	50 // if chance is below this threshold, create events with "convert" as the second option, not the first
+
+#define MAX_TAG_LENGTH          50
+#define MAX_PROVINCE_ID         9999 // The event numbering only has four digits for the province.
+
+// Defines for keyword tags.
+#define TAG_FILE_ID         0
+#define TAG_RNGC            1
+#define TAG_EVENT_ID_PREFIX 2
+#define TAG_OUTPUT_FILE     3
+#define TAG_SET_STRING      4
+#define TAG_TARGET_STRING   5
+#define TAG_START_CONDITION 6
+#define TAG_EVENT_DATA      7
+#define TAG_MODIFICATION    8
+#define TAG_END_OF_DATA     9
+#define TAG_OUTPUT_FILE_MOD 10
+#define TAG_OUTPUT_FILE_MOD_HEADER 11
+#define TAG_EVENT_TEMPLATE  12
+#define TAG_PROVINCE_GROUP  13
+#define TAG_FIRST_USER_TAG  14
+
+// What a tag is bound to.
+#define BIND_NONE       0
+#define BIND_KEYWORD    1
+#define BIND_STRING     2 // Index is a StringArray slot.
+#define BIND_EVENT_DATA 3 // Index is an EventData slot.
+#define BIND_GROUP      4 // Index is a ProvinceGroup slot.
+
+typedef struct {
+    int Kind;
+    int Index;
+} TagBinding;
+
+// A view into the input buffer or the arena (not null terminated).
+typedef struct {
+    const char *Ptr;
+    int Len;
+} StrView;
+
+// The running event ID for each (EventData, province) pair that has been
+// used, kept in a sparse open addressing table (Province 0 = empty slot).
+typedef struct {
+    int Province;
+    int Event;
+    int Index;
+} EventCounter;
+
+// A set of event IDs with a number for each, in an open addressing table
+// (ID 0 = empty slot). Used for the IDs generated from a data file (with the
+// line generating each) and for the ID registry (with the owner of each).
+typedef struct {
+    int ID;
+    int Value;
+} IDSlot;
+
+typedef struct {
+    IDSlot *Slots;
+    int Size, Used;
+} IDTable;
+
+// The event ID registry, see EmpireCreateIDRegistry. Released IDs are kept
+// in the table with Value (the owner) -1.
+struct EmpireIDRegistry {
+    IDTable IDs;
+    char **Owners;            // The data file names.
+    int NumOwners, OwnersSize;
+#ifndef _WIN32
+    pthread_mutex_t Lock;     // The contexts using it may run at the same time.
+#endif
+};
+
+// Table of interned strings, so identical strings share one arena copy.
+typedef struct {
+    const char *Str;
+    int Len;
+    unsigned int Hash;
+} InternEntry;
+
+// A ProvinceGroup, as a bitset of province IDs.
+#define GROUP_WORDS ((MAX_PROVINCE_ID + 32) / 32)
+
+typedef struct {
+    unsigned int Bits[GROUP_WORDS];
+    int NumProvinces;
+} ProvinceGroup;
+
+// Arena for data that lives as long as the parsed data file (tag names etc).
+// Allocations are carved out of large chunks and never freed one by one.
+#define ARENA_CHUNK_SIZE 65536
+
+typedef struct ArenaChunk {
+    struct ArenaChunk *Next;
+} ArenaChunk;
+
+typedef struct {
+    ArenaChunk *Chunks;
+    char *Ptr;
+    size_t Left;
+} Arena;
+
+// The province names, shared by all contexts using the same province file.
+struct EmpireProvinces {
+    int RefCount;
+    const char **Names; // Indexed by province ID.
+    int Size;
+    int Largest;        // The largest province ID.
+    Arena Strings;      // The names.
+};
+
+// Everything about one data file (and the province file used with it). The
+// IR types are declared further down.
+struct Empire {
+    // Diagnostics.
+    const char *FileName; // The current input.
+    int LineNumber, NumErrors, NumWarnings;
+    EmpireDiagnostic *Diags;
+    int NumDiags, DiagsSize;
+    EmpireDiagnosticHandler DiagHandler;
+    void *DiagUser;
+
+    // The current input. The whole file is in memory and scanned by
+    // pointer, so all tags, strings and numbers are picked directly out of
+    // the buffer.
+    const char *InBuf, *InPos, *InEnd;
+
+    Arena Arena; // Tag names, strings, etc. Freed by EmpireReset.
+    InternEntry *InternTable;
+    int InternTableSize, InternTableUsed;
+
+    // Tags.
+    int TagIndex;
+    char **TagArray;          // Interned tag names, indexed by tag ID.
+    TagBinding *TagBindings;  // Indexed by tag ID.
+    int TagArraySize;
+    int *TagHashTable;        // Open addressing, holds tag ID + 1 (0 = empty slot).
+    unsigned int *TagHashes;  // The hash of each tag, indexed by tag ID.
+    int TagHashSize;
+
+    // What the data file defines.
+    int StringIndex;
+    const char **StringArray; // Interned strings, indexed by SetString slot.
+    int StringArraySize;
+    StrView LatestString;     // Points into the input buffer.
+    int RNGCTag;
+    int EventIDPrefix;
+    int (*EventData)[4];      // Tag, NameStr, DescStr, CommandStr
+    int EventDataIndex, EventDataSize;
+    const char *OutputFileModHeader;
+    ProvinceGroup *ProvinceGroups;
+    int NumProvinceGroups, ProvinceGroupsSize;
+    struct TemplateSet *TemplateSets;
+    int NumTemplateSets, TemplateSetsSize;
+    EmpireProvinces *Provinces;
+
+    EventCounter *EventCounters;
+    int EventCountersSize, EventCountersUsed;
+    IDTable EventIDs;         // The IDs generated, with the line of each.
+    EmpireOverlap *Overlaps;  // EmpireFindOverlaps.
+    int NumOverlaps, OverlapsSize;
+    EmpireSimResult *SimResults; // EmpireSimulate.
+    int NumSimResults;
+    EmpireIDRegistry *Registry;
+    int RegistryOwner;        // This data file in Registry.
+
+    // The IR.
+    struct OutputSection *Sections;
+    int NumSections, SectionsSize;
+    struct IRItem *Items;
+    int NumItems, ItemsSize;
+    int CurSection, CurModSection;
+
+    // The output files.
+    int Parsed;               // EmpireParse has been called.
+    EmpireOutput *Outputs;
+    int *OutputSections;      // The section of each output.
+    int NumOutputs;
+
+    // Rendering.
+    struct RenderedItem *Rendered; // Indexed like Items.
+    int *Tasks;                    // The Modification items to render.
+    int NumTasks;
+    int NumThreads;
+    int Compact;                   // EmpireSetCompact.
+    struct WorkQueue *Queues;
+    StrView (*FlagStrings)[8];     // Indexed by EventData and FLAG_* group.
+    struct EventTemplate *StringSplits; // SetStrings split for expansion, by slot.
+    struct Expansion *Expansions;  // The expansion cache, see MakeExpansions.
+    int ExpansionsSize, NumExpansions;
+
+    // Profiling.
+    EmpireStats Stats;
+    int Tracing;
+    EmpireSpan *Spans;
+    int NumSpans, SpansSize;
+};
+
+static const char *const KeywordNames[TAG_FIRST_USER_TAG] = {
+    "ProvinceModificationDataFile", "RNGCTag", "EventIDPrefix", "OutputFile",
+    "SetString", "TargetString", "StartCondition", "EventData",
+    "Modification", "EndOfData", "OutputFileMod", "OutputFileModHeader",
+    "EventTemplate", "ProvinceGroup"
+};
+
+// Perfect hash of the keyword tags: (length + second char + last char) & 31
+// is unique for all of them, so a keyword lookup is one table probe and one
+// compare. Remember to update this table when adding a keyword.
+#define KEYWORD_HASH(s, Len) (((Len) + (unsigned char)(s)[1] + (unsigned char)(s)[(Len) - 1]) & 31)
+static const signed char KeywordSlots[32] = {
+    TAG_EVENT_DATA, -1, -1, -1, TAG_OUTPUT_FILE, -1, TAG_OUTPUT_FILE_MOD, -1,
+    TAG_EVENT_TEMPLATE, TAG_MODIFICATION, -1, -1, -1, -1, -1, TAG_PROVINCE_GROUP,
+    TAG_START_CONDITION, -1, -1, TAG_FILE_ID, TAG_TARGET_STRING, TAG_SET_STRING, -1, -1,
+    TAG_END_OF_DATA, -1, TAG_OUTPUT_FILE_MOD_HEADER, TAG_EVENT_ID_PREFIX, TAG_RNGC, -1, -1, -1
+};
+
+// Memory helpers. Running out of memory isn't something we can recover
+// from, so just bail out.
+static void *MemAlloc(size_t Size)
+{
+    void *p = malloc(Size > 0 ? Size : 1);
+
+    if (p == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    return(p);
+}
+
+static void *MemCalloc(size_t Count, size_t Size)
+{
+    void *p = calloc(Count > 0 ? Count : 1, Size > 0 ? Size : 1);
+
+    if (p == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    return(p);
+}
+
+static void *MemRealloc(void *p, size_t Size)
+{
+    p = realloc(p, Size > 0 ? Size : 1);
+    if (p == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    return(p);
+}
+
+static void *ArenaAlloc(Arena *A, size_t Size)
+{
+    ArenaChunk *Chunk;
+    size_t ChunkSize;
+    void *p;
+
+    // Keep everything pointer aligned.
+    Size = (Size + sizeof(void *) - 1) & ~(sizeof(void *) - 1);
+    if (Size > A->Left) {
+        ChunkSize = Size > ARENA_CHUNK_SIZE ? Size : ARENA_CHUNK_SIZE;
+        Chunk = MemAlloc(sizeof(ArenaChunk) + sizeof(void *) + ChunkSize);
+        Chunk->Next = A->Chunks;
+        A->Chunks = Chunk;
+        A->Ptr = (char *)Chunk + sizeof(ArenaChunk) + sizeof(void *);
+        A->Left = ChunkSize;
+    }
+    p = A->Ptr;
+    A->Ptr += Size;
+    A->Left -= Size;
+    return(p);
+}
+
+// Copy Len chars of s into the arena, null terminated.
+static char *ArenaString(Arena *A, const char *s, int Len)
+{
+    char *p = ArenaAlloc(A, Len + 1);
+
+    memcpy(p, s, Len);
+    p[Len] = 0;
+    return(p);
+}
+
+static void ArenaFree(Arena *A)
+{
+    ArenaChunk *Chunk;
+
+    while ((Chunk = A->Chunks) != NULL) {
+        A->Chunks = Chunk->Next;
+        free(Chunk);
+    }
+    A->Ptr = NULL;
+    A->Left = 0;
+}
+
+// Symbol table for the tags. Keywords are found with the perfect hash above,
+// user tags are interned in a growable open addressing hash table.
+
+// FNV-1a.
+static unsigned int HashBytes(const char *s, int Len)
+{
+    unsigned int h = 2166136261u;
+    int i;
+
+    for (i=0; i<Len; i++) {
+        h = (h ^ (unsigned char)s[i]) * 16777619u;
+    }
+    return(h);
+}
+
+static int LookupKeyword(const char *s, int Len)
+{
+    int k;
+
+    if (Len < 2) {
+        return(-1);
+    }
+    k = KeywordSlots[KEYWORD_HASH(s, Len)];
+    if (k >= 0 && strncmp(KeywordNames[k], s, Len) == 0 && KeywordNames[k][Len] == 0) {
+        return(k);
+    }
+    return(-1);
+}
+
+static void InitTags(Empire *E)
+{
+    int i;
+
+    E->TagArraySize = 256;
+    E->TagArray = MemAlloc(E->TagArraySize * sizeof(char *));
+    E->TagHashes = MemAlloc(E->TagArraySize * sizeof(unsigned int));
+    E->TagBindings = MemAlloc(E->TagArraySize * sizeof(TagBinding));
+    for (i=0; i<TAG_FIRST_USER_TAG; i++) {
+        E->TagArray[i] = (char *)KeywordNames[i];
+        E->TagHashes[i] = 0; // Keywords aren't in the hash table.
+        E->TagBindings[i].Kind = BIND_KEYWORD;
+        E->TagBindings[i].Index = i;
+    }
+    E->TagIndex = TAG_FIRST_USER_TAG;
+    E->TagHashSize = 512;
+    E->TagHashTable = MemCalloc(E->TagHashSize, sizeof(int));
+}
+
+// Double the hash table, reinserting all user tags.
+static void GrowTagHashTable(Empire *E)
+{
+    int i, Slot;
+
+    free(E->TagHashTable);
+    E->TagHashSize *= 2;
+    E->TagHashTable = MemCalloc(E->TagHashSize, sizeof(int));
+    for (i=TAG_FIRST_USER_TAG; i<E->TagIndex; i++) {
+        Slot = E->TagHashes[i] & (E->TagHashSize - 1);
+        while (E->TagHashTable[Slot] != 0) {
+            Slot = (Slot + 1) & (E->TagHashSize - 1);
+        }
+        E->TagHashTable[Slot] = i + 1;
+    }
+}
+
+// Return the tag ID for s, adding it as a new user tag if it isn't known.
+static int InternTag(Empire *E, const char *s, int Len)
+{
+    unsigned int Hash;
+    int Slot, Tag;
+
+    E->Stats.TagLookups++;
+    Tag = LookupKeyword(s, Len);
+    if (Tag >= 0) {
+        return(Tag);
+    }
+    Hash = HashBytes(s, Len);
+    Slot = Hash & (E->TagHashSize - 1);
+    while ((Tag = E->TagHashTable[Slot]) != 0) {
+        Tag--;
+        if (E->TagHashes[Tag] == Hash && strncmp(E->TagArray[Tag], s, Len) == 0 && E->TagArray[Tag][Len] == 0) {
+            // Already known tag.
+            return(Tag);
+        }
+        Slot = (Slot + 1) & (E->TagHashSize - 1);
+    }
+    // New tag.
+    if (E->TagIndex >= E->TagArraySize) {
+        E->TagArraySize *= 2;
+        E->TagArray = MemRealloc(E->TagArray, E->TagArraySize * sizeof(char *));
+        E->TagHashes = MemRealloc(E->TagHashes, E->TagArraySize * sizeof(unsigned int));
+        E->TagBindings = MemRealloc(E->TagBindings, E->TagArraySize * sizeof(TagBinding));
+    }
+    Tag = E->TagIndex++;
+    E->TagArray[Tag] = ArenaString(&E->Arena, s, Len);
+    E->TagHashes[Tag] = Hash;
+    E->TagBindings[Tag].Kind = BIND_NONE;
+    E->TagBindings[Tag].Index = -1;
+    E->TagHashTable[Slot] = Tag + 1;
+    // Keep the load factor below one half.
+    if ((E->TagIndex - TAG_FIRST_USER_TAG) * 2 > E->TagHashSize) {
+        GrowTagHashTable(E);
+    }
+    return(Tag);
+}
+
+// Return an interned, null terminated copy of the Len chars at s.
+static const char *InternString(Empire *E, const char *s, int Len)
+{
+    InternEntry *Old;
+    unsigned int Hash;
+    int i, Slot, OldSize;
+
+    if (E->InternTableUsed * 2 >= E->InternTableSize) {
+        // Grow (or create) the table, reinserting everything.
+        Old = E->InternTable;
+        OldSize = E->InternTableSize;
+        E->InternTableSize = OldSize > 0 ? OldSize * 2 : 256;
+        E->InternTable = MemCalloc(E->InternTableSize, sizeof(InternEntry));
+        for (i=0; i<OldSize; i++) {
+            if (Old[i].Str != NULL) {
+                Slot = Old[i].Hash & (E->InternTableSize - 1);
+                while (E->InternTable[Slot].Str != NULL) {
+                    Slot = (Slot + 1) & (E->InternTableSize - 1);
+                }
+                E->InternTable[Slot] = Old[i];
+            }
+        }
+        free(Old);
+    }
+    Hash = HashBytes(s, Len);
+    Slot = Hash & (E->InternTableSize - 1);
+    while (E->InternTable[Slot].Str != NULL) {
+        if (E->InternTable[Slot].Hash == Hash && E->InternTable[Slot].Len == Len &&
+            memcmp(E->InternTable[Slot].Str, s, Len) == 0) {
+            return(E->InternTable[Slot].Str);
+        }
+        Slot = (Slot + 1) & (E->InternTableSize - 1);
+    }
+    E->InternTable[Slot].Str = ArenaString(&E->Arena, s, Len);
+    E->InternTable[Slot].Len = Len;
+    E->InternTable[Slot].Hash = Hash;
+    E->InternTableUsed++;
+    return(E->InternTable[Slot].Str);
+}
+
+// Return the slot Tag is bound to, or -1 if it isn't bound to that Kind.
+static int GetBinding(Empire *E, int Tag, int Kind)
+{
+    if (Tag < 0 || Tag >= E->TagIndex || E->TagBindings[Tag].Kind != Kind) {
+        return(-1);
+    }
+    return(E->TagBindings[Tag].Index);
+}
+
+// Forward declarations.
+static void Error(Empire *E, const char *s, int c);
+static void Warning(Empire *E, const char *s, int c);
+
+// Bind a user tag to a string or EventData slot. Conflicts are reported
+// here, returns 0 if the binding was made.
+static int BindTag(Empire *E, int Tag, int Kind, int Index)
+{
+    if (Tag < TAG_FIRST_USER_TAG || Tag >= E->TagIndex) {
+        return(-1);
+    }
+    if (E->TagBindings[Tag].Kind == Kind) {
+        // Redefinition, the first one has always been the one used.
+        if (Kind == BIND_STRING) {
+            Warning(E, "string tag already defined, keeping the first definition", 0);
+        } else if (Kind == BIND_GROUP) {
+            Warning(E, "ProvinceGroup tag already defined, keeping the first definition", 0);
+        } else {
+            Warning(E, "EventData tag already defined, keeping the first definition", 0);
+        }
+        return(-1);
+    }
+    if (E->TagBindings[Tag].Kind == BIND_STRING) {
+        Error(E, "tag already used for a string", 0);
+        return(-1);
+    }
+    if (E->TagBindings[Tag].Kind == BIND_EVENT_DATA) {
+        Error(E, "tag already used for an EventData", 0);
+        return(-1);
+    }
+    if (E->TagBindings[Tag].Kind == BIND_GROUP) {
+        Error(E, "tag already used for a ProvinceGroup", 0);
+        return(-1);
+    }
+    E->TagBindings[Tag].Kind = Kind;
+    E->TagBindings[Tag].Index = Index;
+    return(0);
+}
+
+// Helper functions for file parsing.
+// Context used: InBuf, InPos, InEnd, LineNumber, NumErrors, NumWarnings,
+// TagArray, TagIndex, LatestString
+
+static int IsWhitespace(int c)
+{
+    return(c >= 0 && c <= 32);
+}
+
+static int IsLetter(int c)
+{
+    return((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z'));
+}
+
+static int IsDigit(int c)
+{
+    return(c >= '0' && c <= '9');
+}
+
+// Count the line breaks in [p, End).
+static int CountLines(const char *p, const char *End)
+{
+    int Lines = 0;
+
+    for (; p < End; p++) {
+        if (*p == '\n' || *p == '\r') {
+            Lines++;
+        }
+    }
+    return(Lines);
+}
+
+static int GetChar(Empire *E)
+{
+    int c;
+
+    if (E->InPos >= E->InEnd) {
+        return(EOF);
+    }
+    c = (unsigned char)*E->InPos++;
+    if (c == '\n' || c == '\r') {
+        E->LineNumber++;
+    }
+    return(c);
+}
+
+// Peek at the next character without consuming it.
+static int PeekChar(Empire *E)
+{
+    if (E->InPos >= E->InEnd) {
+        return(EOF);
+    }
+    return((unsigned char)*E->InPos);
+}
+
+static void UnGetChar(Empire *E, int c)
+{
+    // Don't bother ungetting whitespace, will be scanned away next anyway
+    // (ungetting newlines would screw up the line counting).
+    if (c != EOF && !IsWhitespace(c)) {
+        E->InPos--;
+    }
+}
+
+static void SkipRestOfLine(Empire *E)
+{
+    const char *p = E->InPos;
+
+    while (p < E->InEnd && *p != '\n' && *p != '\r') {
+        p++;
+    }
+    if (p < E->InEnd) {
+        // Consume the line break too.
+        p++;
+        E->LineNumber++;
+    }
+    E->InPos = p;
+}
+
+static void SkipWhitespacesAndComments(Empire *E)
+{
+    const char *p = E->InPos;
+    int c;
+
+    while (p < E->InEnd) {
+        c = (unsigned char)*p;
+        if (c == '#') {
+            while (p < E->InEnd && *p != '\n' && *p != '\r') {
+                p++;
+            }
+        } else if (IsWhitespace(c)) {
+            if (c == '\n' || c == '\r') {
+                E->LineNumber++;
+            }
+            p++;
+        } else {
+            break;
+        }
+    }
+    E->InPos = p;
+}
+
+// Record a diagnostic. For syntax errors c is the offending character (or
+// EOF), for semantic errors it's 0.
+static void Diagnose(Empire *E, int Severity, const char *s, int c)
+{
+    EmpireDiagnostic *Diag;
+    char *Message;
+
+    Message = ArenaAlloc(&E->Arena, strlen(s) + 16);
+    if (c == 0) {
+        strcpy(Message, s);
+    } else if (c == EOF) {
+        sprintf(Message, "%s, found EOF", s);
+    } else {
+        sprintf(Message, "%s, found '%c'", s, (char)c);
+    }
+    if (E->NumDiags >= E->DiagsSize) {
+        E->DiagsSize = E->DiagsSize > 0 ? E->DiagsSize * 2 : 16;
+        E->Diags = MemRealloc(E->Diags, E->DiagsSize * sizeof(EmpireDiagnostic));
+    }
+    Diag = &E->Diags[E->NumDiags++];
+    Diag->Severity = Severity;
+    Diag->FileName = E->FileName;
+    Diag->Line = E->LineNumber;
+    Diag->Message = Message;
+    if (E->DiagHandler != NULL) {
+        E->DiagHandler(E->DiagUser, Diag);
+    }
+}
+
+static void Error(Empire *E, const char *s, int c)
+{
+    Diagnose(E, EMPIRE_ERROR, s, c);
+    E->NumErrors++;
+}
+
+static void Warning(Empire *E, const char *s, int c)
+{
+    Diagnose(E, EMPIRE_WARNING, s, c);
+    E->NumWarnings++;
+}
+
+// Start scanning a new input buffer.
+static void SetInput(Empire *E, const char *FileName, const char *Buf, size_t Len)
+{
+    E->FileName = ArenaString(&E->Arena, FileName, (int)strlen(FileName));
+    E->InBuf = E->InPos = Buf;
+    E->InEnd = Buf + Len;
+    E->LineNumber = 1;
+}
+
+static void VerifyListStart(Empire *E)
+{
+    int c;
+
+    SkipWhitespacesAndComments(E);
+    c = GetChar(E);
+    if ((char)c != '(') {
+        Error(E, "expected '('", c);
+        UnGetChar(E, c);
+        return;
+    }
+    return;
+}
+
+static void VerifyListEnd(Empire *E)
+{
+    int c;
+
+    SkipWhitespacesAndComments(E);
+    c = GetChar(E);
+    if ((char)c != ')') {
+        Error(E, "expected ')'", c);
+        UnGetChar(E, c);
+        return;
+    }
+    return;
+}
+
+static int GetNum(Empire *E)
+{
+    const char *p;
+    int Negative = 0;
+    long long Num = 0;
+
+    SkipWhitespacesAndComments(E);
+    p = E->InPos;
+    if (p < E->InEnd && (*p == '-' || *p == '+')) {
+        Negative = (*p == '-');
+        p++;
+    }
+    if (p >= E->InEnd || !IsDigit((unsigned char)*p)) {
+        Error(E, "expected a number", PeekChar(E));
+        return(INT_MAX);
+    }
+    while (p < E->InEnd && IsDigit((unsigned char)*p)) {
+        if (Num <= INT_MAX) {
+            Num = Num * 10 + (*p - '0');
+        }
+        p++;
+    }
+    E->InPos = p;
+    if (Num > INT_MAX) {
+        Num = INT_MAX;
+    }
+    return(Negative ? -(int)Num : (int)Num);
+}
+
+static int GetDate(Empire *E)
+{
+    int y, m, d, c;
+
+    y = GetNum(E);
+    c = GetChar(E);
+    if (c != '-') {
+        Error(E, "expected '-'", c);
+        UnGetChar(E, c);
+    }
+    m = GetNum(E);
+    c = GetChar(E);
+    if (c != '-') {
+        Error(E, "expected '-'", c);
+        UnGetChar(E, c);
+    }
+    d = GetNum(E);
+    return(y * 10000 + m * 100 + d);
+}
+
+// Check if d is a valid date on yyyymmdd form (allow less y:s too).
+// Not sure exactly what the EU II engine requires, but for simplicity
+// check for 1 <= year <= 9999, 1 <= month <= 12, 1 <= day <= 30.
+// (Day 31 is not used at any rate, feb 29 and 30 is also not used but
+// I think february is still 30 days for span calculations, so allow them
+// anyway (will be converted to march 1 later on).)
+static int VerifyDate(int date) {
+    int year, month, day;
+
+    day = date % 100;
+    date = date / 100;
+    month = date % 100;
+    year = date / 100;
+    if (year < 1 || year > 9999) {
+        return(0);
+    }
+    if (month < 1 || month > 12) {
+        return(0);
+    }
+    if (day < 1 || day > 30) {
+        return(0);
+    }
+    return(1);
+}
+
+static int GetTag(Empire *E)
+{
+    const char *p, *Start;
+    int Len;
+
+    SkipWhitespacesAndComments(E);
+    p = E->InPos;
+    // The first character should be a letter.
+    if (p >= E->InEnd || !IsLetter((unsigned char)*p)) {
+        Error(E, "expected a tag (starting with a letter)", PeekChar(E));
+        return(INT_MAX);
+    }
+    // The remaining characters should be alphanumeric.
+    Start = p++;
+    while (p < E->InEnd && (IsLetter((unsigned char)*p) || IsDigit((unsigned char)*p))) {
+        p++;
+    }
+    E->InPos = p;
+    Len = (int)(p - Start);
+    if (Len > MAX_TAG_LENGTH) {
+        Warning(E, "tag too long, truncating", 0);
+        Len = MAX_TAG_LENGTH;
+    }
+    return(InternTag(E, Start, Len));
+}
+
+static int GetString(Empire *E)
+{
+    const char *Start, *End;
+
+    SkipWhitespacesAndComments(E);
+    // The first character should be a '"'.
+    if (E->InPos >= E->InEnd || *E->InPos != '"') {
+        Error(E, "expected a string (within '\"' characters)", PeekChar(E));
+        return(INT_MAX);
+    }
+    // The string is everything up to the next '"'.
+    Start = E->InPos + 1;
+    End = memchr(Start, '"', E->InEnd - Start);
+    if (End == NULL) {
+        E->LineNumber += CountLines(Start, E->InEnd);
+        E->InPos = E->InEnd;
+        Error(E, "expected string termination ('\"')", EOF);
+        return(INT_MAX);
+    }
+    E->LineNumber += CountLines(Start, End);
+    // Don't unget the terminating '"'.
+    E->InPos = End + 1;
+    E->LatestString.Ptr = Start;
+    E->LatestString.Len = (int)(End - Start);
+    return(0);
+}
+
+// Return an interned copy of LatestString.
+static const char *InternLatestString(Empire *E)
+{
+    return(InternString(E, E->LatestString.Ptr, E->LatestString.Len));
+}
+
+// Set the name of province Num, growing the name table as needed.
+static void SetProvinceName(Empire *E, int Num, const char *Name, int Len)
+{
+    int i, OldSize;
+
+    if (Num >= E->Provinces->Size) {
+        OldSize = E->Provinces->Size;
+        E->Provinces->Size = OldSize > 0 ? OldSize * 2 : 1024;
+        while (Num >= E->Provinces->Size) {
+            E->Provinces->Size *= 2;
+        }
+        E->Provinces->Names = MemRealloc(E->Provinces->Names, E->Provinces->Size * sizeof(char *));
+        for (i=OldSize; i<E->Provinces->Size; i++) {
+            E->Provinces->Names[i] = "";
+        }
+    }
+    E->Provinces->Names[Num] = ArenaString(&E->Provinces->Strings, Name, Len);
+}
+
+// Helper functions for generating the output events.
+// Context used: TagArray, StringArray, RNGCTag, EventIDPrefix, EventData,
+// EventCounters, Provinces
+
+// Not sure exactly how this works in the EU II engine, but I think each
+// month is 30 days (even february somehow) and each year thus 360 days.
+// Calculate using that assumption and subtract a few days to be on the
+// safe side regarding spans starting or ending in february. (This is used
+// for calculating the event offset, making it slightly too small is no
+// problem, making it too large may result in CTDs.)
+static int CalcDateSpan(int Start, int End)
+{
+    int y1, y2, m1, m2, d1, d2;
+
+    d1 = Start % 100;
+    Start = Start / 100;
+    m1 = Start % 100;
+    y1 = Start / 100;
+    Start = y1 * 360 + (m1 - 1) * 30 + (d1 - 1);
+    d2 = End % 100;
+    End = End / 100;
+    m2 = End % 100;
+    y2 = End / 100;
+    End = y2 * 360 + (m2 - 1) * 30 + (d2 - 1);
+    return(End - Start - 6);
+}
+
+// Return the running event index for the province and EventData.
+static int *GetEventCounter(Empire *E, int ProvinceID, int Event)
+{
+    EventCounter *Old;
+    unsigned int Hash;
+    int i, Slot, OldSize;
+
+    if (E->EventCountersUsed * 2 >= E->EventCountersSize) {
+        // Grow (or create) the table, reinserting everything.
+        Old = E->EventCounters;
+        OldSize = E->EventCountersSize;
+        E->EventCountersSize = OldSize > 0 ? OldSize * 2 : 1024;
+        E->EventCounters = MemCalloc(E->EventCountersSize, sizeof(EventCounter));
+        for (i=0; i<OldSize; i++) {
+            if (Old[i].Province != 0) {
+                Hash = (unsigned int)Old[i].Province * 2654435761u ^ (unsigned int)Old[i].Event * 40503u;
+                Slot = Hash & (E->EventCountersSize - 1);
+                while (E->EventCounters[Slot].Province != 0) {
+                    Slot = (Slot + 1) & (E->EventCountersSize - 1);
+                }
+                E->EventCounters[Slot] = Old[i];
+            }
+        }
+        free(Old);
+    }
+    Hash = (unsigned int)ProvinceID * 2654435761u ^ (unsigned int)Event * 40503u;
+    Slot = Hash & (E->EventCountersSize - 1);
+    while (E->EventCounters[Slot].Province != 0) {
+        if (E->EventCounters[Slot].Province == ProvinceID && E->EventCounters[Slot].Event == Event) {
+            return(&E->EventCounters[Slot].Index);
+        }
+        Slot = (Slot + 1) & (E->EventCountersSize - 1);
+    }
+    E->EventCounters[Slot].Province = ProvinceID;
+    E->EventCounters[Slot].Event = Event;
+    E->EventCounters[Slot].Index = 0;
+    E->EventCountersUsed++;
+    return(&E->EventCounters[Slot].Index);
+}
+
+// Event IDs are built up by concatenating the prefix number + a four digit
+// number for the province ID + a two digit running number for the events
+// used for that province. Example: with the prefix = 717 (as in the original
+// mod), the first event used for province 302 (Hinterpommern in vanilla)
+// would be 717030200, the next 717030201 etc.
+// Each EventData starts ten numbers after the previous one, so once the
+// number passes 99 the ID is another province's.
+static int GenerateEventID(Empire *E, int ProvinceID, int Event)
+{
+    int ID, *Index;
+
+    Index = GetEventCounter(E, ProvinceID, Event);
+    if (Event * 10 + *Index > 99) {
+        Error(E, "too many events generated for the province, the event IDs run into the next province's", 0);
+        return(INT_MAX);
+    }
+    ID = E->EventIDPrefix * 1000000 + ProvinceID * 100 + Event * 10 + *Index;
+    (*Index)++;
+    return(ID);
+}
+
+static unsigned int HashID(int ID)
+{
+    return((unsigned int)ID * 2654435761u);
+}
+
+// The slot of ID in T, or NULL if it's not there.
+static IDSlot *FindID(const IDTable *T, int ID)
+{
+    int Slot;
+
+    if (T->Size == 0) {
+        return(NULL);
+    }
+    Slot = HashID(ID) & (T->Size - 1);
+    while (T->Slots[Slot].ID != 0) {
+        if (T->Slots[Slot].ID == ID) {
+            return(&T->Slots[Slot]);
+        }
+        Slot = (Slot + 1) & (T->Size - 1);
+    }
+    return(NULL);
+}
+
+// The slot of ID in T, added (with Value -1) if it's not there.
+static IDSlot *AddID(IDTable *T, int ID)
+{
+    IDSlot *Old;
+    int i, Slot, OldSize;
+
+    if (T->Used * 2 >= T->Size) {
+        // Grow (or create) the table, reinserting everything.
+        Old = T->Slots;
+        OldSize = T->Size;
+        T->Size = OldSize > 0 ? OldSize * 2 : 1024;
+        T->Slots = MemCalloc(T->Size, sizeof(IDSlot));
+        for (i=0; i<OldSize; i++) {
+            if (Old[i].ID != 0) {
+                Slot = HashID(Old[i].ID) & (T->Size - 1);
+                while (T->Slots[Slot].ID != 0) {
+                    Slot = (Slot + 1) & (T->Size - 1);
+                }
+                T->Slots[Slot] = Old[i];
+            }
+        }
+        free(Old);
+    }
+    Slot = HashID(ID) & (T->Size - 1);
+    while (T->Slots[Slot].ID != 0) {
+        if (T->Slots[Slot].ID == ID) {
+            return(&T->Slots[Slot]);
+        }
+        Slot = (Slot + 1) & (T->Size - 1);
+    }
+    T->Slots[Slot].ID = ID;
+    T->Slots[Slot].Value = -1;
+    T->Used++;
+    return(&T->Slots[Slot]);
+}
+
+// Record an event ID generated for the Modification being numbered. Two
+// Modifications can end up with the same ID (more than ten events for a
+// province and EventData run into the next EventData's numbers), and other
+// data files in the registry may have it; both are errors. Returns -1 for
+// a collision.
+static int UseEventID(Empire *E, int ID)
+{
+    const IDSlot *Owned;
+    IDSlot *Slot;
+    char Message[600];
+
+    Slot = AddID(&E->EventIDs, ID);
+    if (Slot->Value >= 0) {
+        sprintf(Message, "event ID %d is also generated for the Modification on line %d", ID, Slot->Value);
+        Error(E, Message, 0);
+        return(-1);
+    }
+    Slot->Value = E->LineNumber;
+    if (E->Registry != NULL) {
+        Owned = FindID(&E->Registry->IDs, ID);
+        if (Owned != NULL && Owned->Value >= 0 && Owned->Value != E->RegistryOwner) {
+            snprintf(Message, sizeof(Message), "event ID %d is already used by %s", ID,
+                     E->Registry->Owners[Owned->Value]);
+            Error(E, Message, 0);
+            return(-1);
+        }
+    }
+    return(0);
+}
+
+// The default event templates, see EventTemplate in the readme for the
+// placeholders. Each can be replaced from the data file.
+#define TEMPLATE_MOD          0 // The modification event.
+#define TEMPLATE_RNGC         1 // RNGC event, convert is the first option.
+#define TEMPLATE_RNGC_LOW     2 // RNGC event, convert is the second option.
+#define TEMPLATE_RNGC_100P    3 // RNGC event, always convert.
+#define NUM_TEMPLATES         4
+
+static const char *const TemplateNames[NUM_TEMPLATES] = {
+    "ModEvent", "RNGCEvent", "RNGCLowChanceEvent", "RNGC100pEvent"
+};
+
+static const char *const DefaultTemplates[NUM_TEMPLATES] = {
+"\
+event = {\n\
+	id = $EventID$\n\
+	random = no\n\
+	province = $ProvinceID$\n\
+	name = \"EVENTNAME$EventID$\" #$Name$\n\
+	desc = \"$Desc$\"\n\
+	action = {\n\
+		name = \"OK\"\n\
+		command = { $Command$ } #$ProvinceName$\n\
+	}\n\
+}\n\n",
+
+"\
+# $ProvinceName$\n\
+event = {\n\
+	id = $EventID$\n\
+	trigger = {\n\
+$Trigger$\
+$Flag$\
+	}\n\
+	random = no\n\
+	country = $Country$\n\
+	name = \"AI_EVENT\"\n\
+	desc = \"$EventID$\"\n\
+	date = { $StartDate$ }\n\
+	offset = $Offset$\n\
+	deathdate = { $EndDate$ }\n\
+	action = {\n\
+		name = \"OK\"\n\
+		ai_chance = $Chance$\n\
+		command = { type = trigger which = $ModEventID$ }\n\
+	}\n\
+	action = {\n\
+		name = \"OK\"\n\
+		ai_chance = $NoChance$\n\
+		command = { }\n\
+	}\n\
+}\n\n",
+
+// When the user selects AI event choices as Historical, the AI always chooses the first option.
+// To be prepared for that case, provinces with a lower chance of conversion should have the Convert option second.
+"\
+# $ProvinceName$\n\
+event = {\n\
+	id = $EventID$\n\
+	trigger = {\n\
+$Trigger$\
+$Flag$\
+	}\n\
+	random = no\n\
+	country = $Country$\n\
+	name = \"AI_EVENT\"\n\
+	desc = \"$EventID$\"\n\
+	date = { $StartDate$ }\n\
+	offset = $Offset$\n\
+	deathdate = { $EndDate$ }\n\
+	action = {\n\
+		name = \"OK\"\n\
+		ai_chance = $NoChance$\n\
+		command = { }\n\
+	}\n\
+	action = {\n\
+		name = \"OK\"\n\
+		ai_chance = $Chance$\n\
+		command = { type = trigger which = $ModEventID$ }\n\
+	}\n\
+}\n\n",
+
+"\
+# $ProvinceName$\n\
+event = {\n\
+    id = $EventID$\n\
+    trigger = {\n\
+$Trigger$\
+$Flag$\
+    }\n\
+    random = no\n\
+    country = $Country$\n\
+    name = \"AI_EVENT\"\n\
+    desc = \"$EventID$\"\n\
+    date = { $StartDate$ }\n\
+    offset = $Offset$\n\
+    deathdate = { $EndDate$ }\n\
+    action = {\n\
+        name = \"OK\"\n\
+        # Convert\n\
+        command = { type = trigger which = $ModEventID$ }\n\
+    }\n\
+}\n\n"
+};
+
+static const char *const StrMonth[] = {
+    NULL, "january", "february", "march", "april", "may", "june", "july",
+    "august", "september", "october", "november", "december"
+};
+
+// A buffer that grows to fit whatever is appended or formatted into it.
+typedef struct {
+    char *Ptr;
+    size_t Len, Size;
+} GrowBuf;
+
+static void BufReserve(GrowBuf *Buf, size_t Extra)
+{
+    if (Buf->Len + Extra + 1 > Buf->Size) {
+        Buf->Size = Buf->Size > 0 ? Buf->Size * 2 : 1024;
+        while (Buf->Len + Extra + 1 > Buf->Size) {
+            Buf->Size *= 2;
+        }
+        Buf->Ptr = MemRealloc(Buf->Ptr, Buf->Size);
+    }
+}
+
+static void BufAppend(GrowBuf *Buf, const char *s, size_t Len)
+{
+    BufReserve(Buf, Len);
+    memcpy(Buf->Ptr + Buf->Len, s, Len);
+    Buf->Len += Len;
+    Buf->Ptr[Buf->Len] = 0;
+}
+
+static void BufVPrintf(GrowBuf *Buf, const char *Format, va_list Args)
+{
+    va_list Args2;
+    int Len;
+
+    va_copy(Args2, Args);
+    BufReserve(Buf, 0);
+    Len = vsnprintf(Buf->Ptr + Buf->Len, Buf->Size - Buf->Len, Format, Args);
+    if (Len >= 0 && Buf->Len + (size_t)Len >= Buf->Size) {
+        BufReserve(Buf, (size_t)Len);
+        vsnprintf(Buf->Ptr + Buf->Len, Buf->Size - Buf->Len, Format, Args2);
+    }
+    va_end(Args2);
+    if (Len > 0) {
+        Buf->Len += (size_t)Len;
+    }
+}
+
+// Format into Buf from the start, returning the null terminated result.
+static char *FormatString(GrowBuf *Buf, const char *Format, ...)
+{
+    va_list Args;
+
+    Buf->Len = 0;
+    va_start(Args, Format);
+    BufVPrintf(Buf, Format, Args);
+    va_end(Args);
+    return(Buf->Ptr);
+}
+
+static void BufFree(GrowBuf *Buf)
+{
+    free(Buf->Ptr);
+    Buf->Ptr = NULL;
+    Buf->Len = Buf->Size = 0;
+}
+
+// Temporary buffers used during event generation. Each thread rendering
+// events has its own set.
+typedef struct {
+    GrowBuf Compacted;
+    // Counters and trace spans for the context, added to it when done.
+    EmpireStats Stats;
+    int Thread, SpanOpen, SpanSection;
+    EmpireSpan *Spans;
+    int NumSpans, SpansSize;
+} RenderState;
+
+static void FreeRenderState(RenderState *State)
+{
+    BufFree(&State->Compacted);
+    free(State->Spans);
+}
+
+// Event templates are compiled once into a list of segments, each either
+// a literal piece of text or a placeholder, and emitted by appending the
+// segments one after the other.
+#define PH_LITERAL       0
+#define PH_PROVINCE_ID   1
+#define PH_PROVINCE_NAME 2
+#define PH_EVENT_ID      3
+#define PH_MOD_EVENT_ID  4
+#define PH_NAME          5
+#define PH_DESC          6
+#define PH_COMMAND       7
+#define PH_TRIGGER       8
+#define PH_FLAG          9
+#define PH_COUNTRY       10
+#define PH_START_DATE    11
+#define PH_END_DATE      12
+#define PH_OFFSET        13
+#define PH_CHANCE        14
+#define PH_NO_CHANCE     15
+#define NUM_PLACEHOLDERS 16
+
+static const char *const PlaceholderNames[NUM_PLACEHOLDERS] = {
+    NULL, "ProvinceID", "ProvinceName", "EventID", "ModEventID", "Name",
+    "Desc", "Command", "Trigger", "Flag", "Country", "StartDate", "EndDate",
+    "Offset", "Chance", "NoChance"
+};
+
+// Which placeholders are numbers (the rest are strings).
+static const char PlaceholderIsNum[NUM_PLACEHOLDERS] = {
+    0, 1, 0, 1, 1, 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1
+};
+
+// Which placeholders each template can use.
+#define PH_MASK(p) (1 << (p))
+#define PH_COMMON (PH_MASK(PH_PROVINCE_ID) | PH_MASK(PH_PROVINCE_NAME) | \
+                   PH_MASK(PH_EVENT_ID) | PH_MASK(PH_MOD_EVENT_ID))
+#define PH_RNGC   (PH_COMMON | PH_MASK(PH_TRIGGER) | PH_MASK(PH_FLAG) | \
+                   PH_MASK(PH_COUNTRY) | PH_MASK(PH_START_DATE) | \
+                   PH_MASK(PH_END_DATE) | PH_MASK(PH_OFFSET))
+static const int TemplatePlaceholders[NUM_TEMPLATES] = {
+    PH_COMMON | PH_MASK(PH_NAME) | PH_MASK(PH_DESC) | PH_MASK(PH_COMMAND),
+    PH_RNGC | PH_MASK(PH_CHANCE) | PH_MASK(PH_NO_CHANCE),
+    PH_RNGC | PH_MASK(PH_CHANCE) | PH_MASK(PH_NO_CHANCE),
+    PH_RNGC
+};
+
+typedef struct {
+    int Kind;        // PH_LITERAL or the placeholder.
+    const char *Ptr; // Literal text (not null terminated).
+    int Len;
+} TemplateSegment;
+
+typedef struct EventTemplate {
+    TemplateSegment *Segments;
+    int NumSegments;
+} EventTemplate;
+
+// The values to fill in the placeholders with.
+typedef struct {
+    int Num[NUM_PLACEHOLDERS];
+    StrView Str[NUM_PLACEHOLDERS];
+} TemplateArgs;
+
+// Compile Len chars of Text as template Template. Literal segments point
+// into Text, which has to stay around. Returns 0 on success.
+static int CompileTemplate(Empire *E, EventTemplate *Out, int Template, const char *Text, int Len)
+{
+    TemplateSegment *Segments;
+    const char *p = Text, *End = Text + Len, *Start, *Close;
+    int n = 0, Kind, NameLen;
+
+    // There can't be more segments than twice the number of '$' plus one.
+    for (Start=Text; Start<End; Start++) {
+        if (*Start == '$') {
+            n++;
+        }
+    }
+    Segments = ArenaAlloc(&E->Arena, (n + 1) * sizeof(TemplateSegment));
+    n = 0;
+    while (p < End) {
+        Start = p;
+        while (p < End && *p != '$') {
+            p++;
+        }
+        if (p > Start) {
+            Segments[n].Kind = PH_LITERAL;
+            Segments[n].Ptr = Start;
+            Segments[n].Len = (int)(p - Start);
+            n++;
+        }
+        if (p >= End) {
+            break;
+        }
+        // A placeholder, "$$" for a '$' or "$Quote$" for a '"' (strings
+        // can't contain those otherwise).
+        Close = memchr(p + 1, '$', End - p - 1);
+        if (Close == NULL) {
+            Error(E, "unterminated placeholder in EventTemplate", 0);
+            return(-1);
+        }
+        NameLen = (int)(Close - p - 1);
+        if (NameLen == 0) {
+            Segments[n].Kind = PH_LITERAL;
+            Segments[n].Ptr = p;
+            Segments[n].Len = 1;
+            n++;
+        } else if (NameLen == 5 && strncmp(p + 1, "Quote", 5) == 0) {
+            Segments[n].Kind = PH_LITERAL;
+            Segments[n].Ptr = "\"";
+            Segments[n].Len = 1;
+            n++;
+        } else {
+            for (Kind=1; Kind<NUM_PLACEHOLDERS; Kind++) {
+                if (strncmp(PlaceholderNames[Kind], p + 1, NameLen) == 0 &&
+                    PlaceholderNames[Kind][NameLen] == 0) {
+                    break;
+                }
+            }
+            if (Kind >= NUM_PLACEHOLDERS) {
+                Error(E, "unknown placeholder in EventTemplate", 0);
+                return(-1);
+            }
+            if ((TemplatePlaceholders[Template] & PH_MASK(Kind)) == 0) {
+                Error(E, "placeholder not available in this EventTemplate", 0);
+                return(-1);
+            }
+            Segments[n].Kind = Kind;
+            Segments[n].Ptr = NULL;
+            Segments[n].Len = 0;
+            n++;
+        }
+        p = Close + 1;
+    }
+    Out->Segments = Segments;
+    Out->NumSegments = n;
+    return(0);
+}
+
+// Append a number in decimal, two digits at a time.
+static void BufAppendInt(GrowBuf *Buf, int Num)
+{
+    static const char Pairs[201] =
+        "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+        "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+        "8081828384858687888990919293949596979899";
+    char Digits[12], *p = Digits + sizeof(Digits);
+    unsigned int u = Num < 0 ? 0u - (unsigned int)Num : (unsigned int)Num;
+
+    while (u >= 100) {
+        p -= 2;
+        memcpy(p, &Pairs[(u % 100) * 2], 2);
+        u /= 100;
+    }
+    if (u >= 10) {
+        p -= 2;
+        memcpy(p, &Pairs[u * 2], 2);
+    } else {
+        *--p = (char)('0' + u);
+    }
+    if (Num < 0) {
+        *--p = '-';
+    }
+    BufAppend(Buf, p, Digits + sizeof(Digits) - p);
+}
+
+static void EmitTemplate(GrowBuf *Out, const EventTemplate *Template, const TemplateArgs *Args)
+{
+    const TemplateSegment *Seg = Template->Segments;
+    const TemplateSegment *End = Seg + Template->NumSegments;
+
+    for (; Seg<End; Seg++) {
+        if (Seg->Kind == PH_LITERAL) {
+            BufAppend(Out, Seg->Ptr, Seg->Len);
+        } else if (PlaceholderIsNum[Seg->Kind]) {
+            BufAppendInt(Out, Args->Num[Seg->Kind]);
+        } else {
+            BufAppend(Out, Args->Str[Seg->Kind].Ptr, Args->Str[Seg->Kind].Len);
+        }
+    }
+}
+
+// The templates in effect. Each EventTemplate in the data file makes a new
+// set, used by the Modifications following it.
+typedef struct TemplateSet {
+    EventTemplate Templates[NUM_TEMPLATES];
+} TemplateSet;
+
+static void InitTemplates(Empire *E)
+{
+    int i;
+
+    E->NumTemplateSets = 0;
+    E->TemplateSetsSize = 4;
+    E->TemplateSets = MemAlloc(E->TemplateSetsSize * sizeof(TemplateSet));
+    for (i=0; i<NUM_TEMPLATES; i++) {
+        CompileTemplate(E, &E->TemplateSets[0].Templates[i], i, DefaultTemplates[i], (int)strlen(DefaultTemplates[i]));
+    }
+    E->NumTemplateSets = 1;
+}
+
+// Replace one template, from here on in the data file.
+static void SetTemplate(Empire *E, int Template, const char *Text, int Len)
+{
+    EventTemplate Compiled;
+
+    if (CompileTemplate(E, &Compiled, Template, Text, Len) != 0) {
+        return;
+    }
+    if (E->NumTemplateSets >= E->TemplateSetsSize) {
+        E->TemplateSetsSize *= 2;
+        E->TemplateSets = MemRealloc(E->TemplateSets, E->TemplateSetsSize * sizeof(TemplateSet));
+    }
+    E->TemplateSets[E->NumTemplateSets] = E->TemplateSets[E->NumTemplateSets - 1];
+    E->TemplateSets[E->NumTemplateSets].Templates[Template] = Compiled;
+    E->NumTemplateSets++;
+}
+
+static void SetStr(TemplateArgs *Args, int Kind, const char *s, int Len)
+{
+    Args->Str[Kind].Ptr = s;
+    Args->Str[Kind].Len = Len;
+}
+
+// The RNGC event for a chance applies to the versions of the Modification
+// (Small, Normal, Large) that have that chance, so its flag condition only
+// depends on which of them share it. A group is a combination of these.
+#define FLAG_SMALL  1
+#define FLAG_NORMAL 2
+#define FLAG_LARGE  4
+
+// The distinct non-zero chances of a Modification in increasing order (the
+// order of its RNGC events), and the group of versions having each.
+// Returns the number of chances, at most three.
+static int GroupChances(int Small, int Normal, int Large, int *Chances, int *Groups)
+{
+    int Versions[3], i, j, Num = 0;
+
+    Versions[0] = Small;
+    Versions[1] = Normal;
+    Versions[2] = Large;
+    for (i=0; i<3; i++) {
+        if (Versions[i] <= 0) {
+            // No events for this version.
+            continue;
+        }
+        for (j=0; j<Num && Chances[j] != Versions[i]; j++) {
+        }
+        if (j < Num) {
+            // Shared with a version before it.
+            Groups[j] |= 1 << i;
+            continue;
+        }
+        for (j=Num; j>0 && Chances[j - 1] > Versions[i]; j--) {
+            Chances[j] = Chances[j - 1];
+            Groups[j] = Groups[j - 1];
+        }
+        Chances[j] = Versions[i];
+        Groups[j] = 1 << i;
+        Num++;
+    }
+    return(Num);
+}
+
+// The data file is compiled in two phases. The parse phase builds an
+// intermediate representation (IR) of everything that should be output:
+// the output file sections and, in source order, the TargetStrings,
+// StartConditions and Modifications written to them. Only when the whole
+// file has parsed (and checked) without errors can the generation phase
+// turn the IR into output files, so a broken data file never leaves half
+// written output behind.
+
+// One OutputFile or OutputFileMod statement.
+typedef struct OutputSection {
+    const char *FileName; // Interned, so equal names have equal pointers.
+    int IsMod;            // OutputFileMod rather than OutputFile.
+    const char *Header;   // The OutputFileModHeader at the time, for mod files.
+    int Line;
+    int FirstItem, LastItem; // The items output to this section, -1 if none.
+    unsigned long long Hash; // Of everything the section's output depends on.
+    int Dirty;               // To be rendered: the last section for its file, not skipped.
+} OutputSection;
+
+// Kinds of IR items.
+#define ITEM_TARGET_STRING   0
+#define ITEM_START_CONDITION 1
+#define ITEM_MODIFICATION    2
+
+// One TargetString, StartCondition or Modification.
+typedef struct IRItem {
+    int Kind;
+    int Line;
+    int Section;      // The OutputFile section.
+    int ModSection;   // The OutputFileMod section (Modifications only).
+    int Next;         // The next item in Section, -1 if none.
+    int NextMod;      // The next item in ModSection, -1 if none.
+    StrView Text;     // TargetString.
+    int ProvinceID;   // StartCondition and Modification.
+    int Str;          // StartCondition string slot.
+    int Event, Trigger, StartDate, EndDate, Small, Normal, Large; // Modification.
+    int ModID;        // Modification event ID, the RNGC events follow it.
+    int Group;        // Modification of a ProvinceGroup, -1 for one province.
+    int *ModIDs;      // Group: the ModID of each province, in ID order.
+    int Templates;    // Modification: the TemplateSet in effect.
+    StrView StartText, EndText; // Modification: the dates as EU II event date strings,
+    int Offset;                 // and the event offset, see MakeDateStrings.
+} IRItem;
+
+static int AddSection(Empire *E, const char *FileName, int IsMod)
+{
+    OutputSection *Section;
+
+    if (E->NumSections >= E->SectionsSize) {
+        E->SectionsSize = E->SectionsSize > 0 ? E->SectionsSize * 2 : 32;
+        E->Sections = MemRealloc(E->Sections, E->SectionsSize * sizeof(OutputSection));
+    }
+    Section = &E->Sections[E->NumSections];
+    Section->FileName = FileName;
+    Section->IsMod = IsMod;
+    Section->Header = IsMod ? E->OutputFileModHeader : NULL;
+    Section->Line = E->LineNumber;
+    Section->FirstItem = Section->LastItem = -1;
+    Section->Hash = 0;
+    Section->Dirty = 1;
+    return(E->NumSections++);
+}
+
+// Append an item to the current section (and mod section, for
+// Modifications). The caller checks that they are valid.
+static IRItem *AddItem(Empire *E, int Kind)
+{
+    IRItem *Item;
+    int i;
+
+    if (E->NumItems >= E->ItemsSize) {
+        E->ItemsSize = E->ItemsSize > 0 ? E->ItemsSize * 2 : 256;
+        E->Items = MemRealloc(E->Items, E->ItemsSize * sizeof(IRItem));
+    }
+    i = E->NumItems++;
+    Item = &E->Items[i];
+    memset(Item, 0, sizeof(IRItem));
+    Item->Kind = Kind;
+    Item->Line = E->LineNumber;
+    Item->Section = E->CurSection;
+    Item->ModSection = Kind == ITEM_MODIFICATION ? E->CurModSection : -1;
+    Item->Next = Item->NextMod = -1;
+    Item->ModID = INT_MAX;
+    Item->Group = -1;
+    Item->Templates = E->NumTemplateSets - 1;
+    if (E->Sections[E->CurSection].LastItem >= 0) {
+        E->Items[E->Sections[E->CurSection].LastItem].Next = i;
+    } else {
+        E->Sections[E->CurSection].FirstItem = i;
+    }
+    E->Sections[E->CurSection].LastItem = i;
+    if (Item->ModSection >= 0) {
+        if (E->Sections[E->CurModSection].LastItem >= 0) {
+            E->Items[E->Sections[E->CurModSection].LastItem].NextMod = i;
+        } else {
+            E->Sections[E->CurModSection].FirstItem = i;
+        }
+        E->Sections[E->CurModSection].LastItem = i;
+    }
+    return(Item);
+}
+
+// The next province in Group after Province (start with 0), or 0 when
+// there are no more.
+static int NextInGroup(const ProvinceGroup *Group, int Province)
+{
+    unsigned int Word;
+    int i = Province + 1;
+
+    while (i <= MAX_PROVINCE_ID) {
+        Word = Group->Bits[i / 32] >> (i % 32);
+        if (Word == 0) {
+            i = (i / 32 + 1) * 32;
+            continue;
+        }
+        while ((Word & 1) == 0) {
+            Word >>= 1;
+            i++;
+        }
+        return(i);
+    }
+    return(0);
+}
+
+// The number of RNGC events a Modification needs: one for each distinct
+// non-zero probability.
+static int CountRNGCEvents(int Small, int Normal, int Large)
+{
+    int Chances[3], Groups[3];
+
+    return(GroupChances(Small, Normal, Large, Chances, Groups));
+}
+
+static void LockRegistry(EmpireIDRegistry *R)
+{
+#ifndef _WIN32
+    pthread_mutex_lock(&R->Lock);
+#endif
+}
+
+static void UnlockRegistry(EmpireIDRegistry *R)
+{
+#ifndef _WIN32
+    pthread_mutex_unlock(&R->Lock);
+#endif
+}
+
+// The index of a data file in the registry's owners, added if it's new.
+static int GetOwner(EmpireIDRegistry *R, const char *FileName)
+{
+    int i;
+
+    for (i=0; i<R->NumOwners; i++) {
+        if (strcmp(R->Owners[i], FileName) == 0) {
+            return(i);
+        }
+    }
+    if (R->NumOwners >= R->OwnersSize) {
+        R->OwnersSize = R->OwnersSize > 0 ? R->OwnersSize * 2 : 16;
+        R->Owners = MemRealloc(R->Owners, R->OwnersSize * sizeof(char *));
+    }
+    R->Owners[R->NumOwners] = MemAlloc(strlen(FileName) + 1);
+    strcpy(R->Owners[R->NumOwners], FileName);
+    return(R->NumOwners++);
+}
+
+// Replace the IDs Owner has in the registry with those in IDs.
+static void ClaimEventIDs(EmpireIDRegistry *R, const IDTable *IDs, int Owner)
+{
+    int i;
+
+    for (i=0; i<R->IDs.Size; i++) {
+        if (R->IDs.Slots[i].Value == Owner) {
+            R->IDs.Slots[i].Value = -1;
+        }
+    }
+    for (i=0; i<IDs->Size; i++) {
+        if (IDs->Slots[i].ID != 0) {
+            AddID(&R->IDs, IDs->Slots[i].ID)->Value = Owner;
+        }
+    }
+}
+
+// The modification event ID for a province, followed by n for the RNGC events.
+static int AssignModID(Empire *E, int ProvinceID, int Event, int n)
+{
+    int ModID = INT_MAX, ID, i;
+
+    for (i=0; i<=n; i++) {
+        ID = GenerateEventID(E, ProvinceID, Event);
+        if (ID == INT_MAX) {
+            // Reported, and the rest would be out of range too.
+            return(INT_MAX);
+        }
+        if (i == 0) {
+            ModID = ID;
+        }
+        UseEventID(E, ID);
+    }
+    return(ModID);
+}
+
+// Allocate the event IDs of all Modifications, in source order so the
+// numbering stays the same as when they were generated on the fly. The
+// modification event gets the first ID and the RNGC events the following
+// ones (all from the same running number).
+static void AssignEventIDs(Empire *E)
+{
+    const ProvinceGroup *Group;
+    IRItem *Item;
+    int i, n, k, p;
+
+    if (E->Registry != NULL) {
+        // Held until the IDs are claimed, so the data files sharing the
+        // registry are checked against each other one at a time.
+        LockRegistry(E->Registry);
+        E->RegistryOwner = GetOwner(E->Registry, E->FileName);
+    }
+    for (i=0; i<E->NumItems; i++) {
+        Item = &E->Items[i];
+        if (Item->Kind != ITEM_MODIFICATION) {
+            continue;
+        }
+        n = CountRNGCEvents(Item->Small, Item->Normal, Item->Large);
+        if (n == 0) {
+            // Nothing to generate.
+            continue;
+        }
+        E->LineNumber = Item->Line;
+        if (Item->Group < 0) {
+            Item->ModID = AssignModID(E, Item->ProvinceID, Item->Event, n);
+            continue;
+        }
+        // Numbered as if each province had a Modification of its own.
+        Group = &E->ProvinceGroups[Item->Group];
+        Item->ModIDs = ArenaAlloc(&E->Arena, Group->NumProvinces * sizeof(int));
+        for (k=0, p=NextInGroup(Group, 0); p>0; k++, p=NextInGroup(Group, p)) {
+            Item->ModIDs[k] = AssignModID(E, p, Item->Event, n);
+            if (Item->ModIDs[k] != INT_MAX) {
+                Item->ModID = Item->ModIDs[k];
+            }
+        }
+    }
+    if (E->Registry != NULL) {
+        if (E->NumErrors == 0) {
+            ClaimEventIDs(E->Registry, &E->EventIDs, E->RegistryOwner);
+        }
+        UnlockRegistry(E->Registry);
+    }
+}
+
+// Checks that need the whole data file.
+static void CheckProgram(Empire *E)
+{
+    int i, j;
+
+    // The RNGC tag and event prefix are needed as soon as there's anything
+    // to generate.
+    for (i=0; i<E->NumItems; i++) {
+        if (E->Items[i].Kind == ITEM_MODIFICATION) {
+            E->LineNumber = E->Items[i].Line;
+            if (E->RNGCTag == INT_MAX) {
+                Error(E, "undefined RNGCTag", 0);
+            }
+            if (E->EventIDPrefix == INT_MAX) {
+                Error(E, "undefined EventIDPrefix", 0);
+            }
+            break;
+        }
+    }
+    // Output files: an OutputFile and an OutputFileMod can't share a file,
+    // and opening the same file again throws away what was written to it.
+    for (i=0; i<E->NumSections; i++) {
+        for (j=0; j<i; j++) {
+            if (E->Sections[j].FileName == E->Sections[i].FileName) {
+                E->LineNumber = E->Sections[i].Line;
+                if (E->Sections[j].IsMod != E->Sections[i].IsMod) {
+                    Error(E, "the same file is used for both OutputFile and OutputFileMod", 0);
+                } else {
+                    Warning(E, "output file opened again, its earlier contents will be lost", 0);
+                }
+                break;
+            }
+        }
+    }
+}
+
+// Each output section gets a hash of everything its output depends on: the
+// items, the strings, province names, event IDs and templates they use, and
+// the RNGC tag. A caller that remembers the hashes of the files it wrote can
+// skip generating the ones that haven't changed (Empire -i does).
+#define HASH_VERSION 1 // Bump when the generated output changes.
+
+static unsigned long long HashUpdate(unsigned long long h, const void *p, size_t Len)
+{
+    const unsigned char *s = p;
+    size_t i;
+
+    // 64 bit FNV-1a.
+    for (i=0; i<Len; i++) {
+        h = (h ^ s[i]) * 1099511628211ull;
+    }
+    return(h);
+}
+
+static unsigned long long HashInt(unsigned long long h, int Num)
+{
+    return(HashUpdate(h, &Num, sizeof(Num)));
+}
+
+// Strings are hashed with their terminating null, so "ab" + "c" differs
+// from "a" + "bc".
+static unsigned long long HashStr(unsigned long long h, const char *s)
+{
+    return(HashUpdate(h, s, strlen(s) + 1));
+}
+
+static unsigned long long HashTemplate(unsigned long long h, const EventTemplate *Template)
+{
+    const TemplateSegment *Seg;
+    int i;
+
+    for (i=0; i<Template->NumSegments; i++) {
+        Seg = &Template->Segments[i];
+        h = HashInt(h, Seg->Kind);
+        if (Seg->Kind == PH_LITERAL) {
+            h = HashInt(h, Seg->Len);
+            h = HashUpdate(h, Seg->Ptr, Seg->Len);
+        }
+    }
+    return(HashInt(h, -1));
+}
+
+static void HashSections(Empire *E)
+{
+    OutputSection *Section;
+    const TemplateSet *Set;
+    const ProvinceGroup *Group;
+    IRItem *Item;
+    unsigned long long h;
+    int s, i, k, p, Event;
+
+    for (s=0; s<E->NumSections; s++) {
+        Section = &E->Sections[s];
+        h = HashInt(14695981039346656037ull, HASH_VERSION);
+        h = HashInt(h, Section->IsMod);
+        if (E->Compact) {
+            // Not hashed otherwise, so caches of full outputs stay valid.
+            h = HashInt(h, 1);
+        }
+        if (Section->IsMod) {
+            h = HashStr(h, Section->Header);
+        }
+        for (i=Section->FirstItem; i>=0; i=Section->IsMod ? E->Items[i].NextMod : E->Items[i].Next) {
+            Item = &E->Items[i];
+            h = HashInt(h, Item->Kind);
+            switch (Item->Kind) {
+                case ITEM_TARGET_STRING:
+                    h = HashInt(h, Item->Text.Len);
+                    h = HashUpdate(h, Item->Text.Ptr, Item->Text.Len);
+                    break;
+                case ITEM_START_CONDITION:
+                    h = HashInt(h, Item->ProvinceID);
+                    h = HashStr(h, E->StringArray[Item->Str]);
+                    break;
+                case ITEM_MODIFICATION:
+                    // The IDs carry the EventIDPrefix and the numbering.
+                    h = HashInt(h, Item->ModID);
+                    if (Item->ModID == INT_MAX) {
+                        break;
+                    }
+                    Event = Item->Event;
+                    Set = &E->TemplateSets[Item->Templates];
+                    if (Item->Group < 0) {
+                        h = HashInt(h, Item->ProvinceID);
+                        h = HashStr(h, E->Provinces->Names[Item->ProvinceID]);
+                    } else {
+                        Group = &E->ProvinceGroups[Item->Group];
+                        for (k=0, p=NextInGroup(Group, 0); p>0; k++, p=NextInGroup(Group, p)) {
+                            h = HashInt(h, p);
+                            h = HashInt(h, Item->ModIDs[k]);
+                            h = HashStr(h, E->Provinces->Names[p]);
+                        }
+                        h = HashInt(h, -1);
+                    }
+                    if (Section->IsMod) {
+                        h = HashStr(h, E->StringArray[E->EventData[Event][1]]);
+                        h = HashStr(h, E->StringArray[E->EventData[Event][2]]);
+                        h = HashStr(h, E->StringArray[E->EventData[Event][3]]);
+                        h = HashTemplate(h, &Set->Templates[TEMPLATE_MOD]);
+                    } else {
+                        h = HashStr(h, E->TagArray[E->EventData[Event][0]]);
+                        h = HashStr(h, E->TagArray[E->RNGCTag]);
+                        h = HashStr(h, E->StringArray[Item->Trigger]);
+                        h = HashInt(h, Item->StartDate);
+                        h = HashInt(h, Item->EndDate);
+                        h = HashInt(h, Item->Small);
+                        h = HashInt(h, Item->Normal);
+                        h = HashInt(h, Item->Large);
+                        h = HashTemplate(h, &Set->Templates[TEMPLATE_RNGC]);
+                        h = HashTemplate(h, &Set->Templates[TEMPLATE_RNGC_LOW]);
+                        h = HashTemplate(h, &Set->Templates[TEMPLATE_RNGC_100P]);
+                    }
+                    break;
+            }
+        }
+        Section->Hash = h;
+    }
+}
+
+// Only the last section written to a file decides what it ends up with.
+static int IsLastSection(Empire *E, int s)
+{
+    int j;
+
+    for (j=s+1; j<E->NumSections; j++) {
+        if (E->Sections[j].FileName == E->Sections[s].FileName) {
+            return(0);
+        }
+    }
+    return(1);
+}
+
+// The SetStrings used as names, descriptions, commands and triggers have
+// '%s' replaced by the province name and '%d' by the province ID. Each is
+// split once into segments like an event template ("%%" is a '%', and a
+// '%' followed by anything else is copied as it is), so expanding it is
+// just a concatenation.
+static const EventTemplate *SplitString(Empire *E, int Slot)
+{
+    EventTemplate *Split;
+    TemplateSegment *Seg;
+    const char *p, *Start;
+    int n = 0;
+
+    if (E->StringSplits == NULL) {
+        E->StringSplits = MemCalloc(E->StringIndex > 0 ? E->StringIndex : 1, sizeof(EventTemplate));
+    }
+    Split = &E->StringSplits[Slot];
+    if (Split->Segments != NULL) {
+        return(Split);
+    }
+    // Each '%' makes at most a placeholder and the literal before it.
+    for (p=E->StringArray[Slot]; *p != 0; p++) {
+        if (*p == '%') {
+            n++;
+        }
+    }
+    Split->Segments = Seg = ArenaAlloc(&E->Arena, (2 * n + 1) * sizeof(TemplateSegment));
+    p = E->StringArray[Slot];
+    while (*p != 0) {
+        Start = p;
+        while (*p != 0 && !(p[0] == '%' && (p[1] == 's' || p[1] == 'd' || p[1] == '%'))) {
+            p++;
+        }
+        if (p > Start) {
+            Seg->Kind = PH_LITERAL;
+            Seg->Ptr = Start;
+            Seg->Len = (int)(p - Start);
+            Seg++;
+        }
+        if (*p == 0) {
+            break;
+        }
+        Seg->Kind = p[1] == 's' ? PH_PROVINCE_NAME : p[1] == 'd' ? PH_PROVINCE_ID : PH_LITERAL;
+        Seg->Ptr = p;
+        Seg->Len = Seg->Kind == PH_LITERAL;
+        Seg++;
+        p += 2;
+    }
+    Split->NumSegments = (int)(Seg - Split->Segments);
+    return(Split);
+}
+
+// The expansion cache: the text of a SetString slot expanded for a
+// province. A province often gets several Modifications with the same
+// EventData and trigger (e.g. a Protestant-then-Reformed chain), and those
+// share the expansions.
+typedef struct Expansion {
+    int Slot, ProvinceID;
+    StrView Text; // Ptr is NULL for an empty entry.
+} Expansion;
+
+// Both halves of the key end up in the low bits the table uses.
+static unsigned int HashExpansion(int Slot, int ProvinceID)
+{
+    unsigned int h = (unsigned int)Slot * 2654435761u ^ (unsigned int)ProvinceID;
+
+    h ^= h >> 16;
+    h *= 0x45d9f3bu;
+    h ^= h >> 16;
+    return(h);
+}
+
+// The entry of Slot and ProvinceID, or the empty entry where it would go.
+static Expansion *FindExpansion(Empire *E, int Slot, int ProvinceID)
+{
+    unsigned int Mask = (unsigned int)E->ExpansionsSize - 1;
+    unsigned int i = HashExpansion(Slot, ProvinceID) & Mask;
+
+    while (E->Expansions[i].Text.Ptr != NULL &&
+           (E->Expansions[i].Slot != Slot || E->Expansions[i].ProvinceID != ProvinceID)) {
+        i = (i + 1) & Mask;
+    }
+    return(&E->Expansions[i]);
+}
+
+// Expand Slot for ProvinceID into the cache, unless it's there already.
+static void AddExpansion(Empire *E, GrowBuf *Temp, int Slot, int ProvinceID)
+{
+    Expansion *Old, *Entry;
+    TemplateArgs Args;
+    int i, OldSize;
+
+    if (E->NumExpansions * 2 >= E->ExpansionsSize) {
+        Old = E->Expansions;
+        OldSize = E->ExpansionsSize;
+        E->ExpansionsSize = OldSize > 0 ? OldSize * 2 : 1024;
+        E->Expansions = MemCalloc(E->ExpansionsSize, sizeof(Expansion));
+        for (i=0; i<OldSize; i++) {
+            if (Old[i].Text.Ptr != NULL) {
+                *FindExpansion(E, Old[i].Slot, Old[i].ProvinceID) = Old[i];
+            }
+        }
+        free(Old);
+    }
+    Entry = FindExpansion(E, Slot, ProvinceID);
+    if (Entry->Text.Ptr != NULL) {
+        E->Stats.ExpansionCacheHits++;
+        return;
+    }
+    Args.Num[PH_PROVINCE_ID] = ProvinceID;
+    SetStr(&Args, PH_PROVINCE_NAME, E->Provinces->Names[ProvinceID], (int)strlen(E->Provinces->Names[ProvinceID]));
+    Temp->Len = 0;
+    EmitTemplate(Temp, SplitString(E, Slot), &Args);
+    Entry->Slot = Slot;
+    Entry->ProvinceID = ProvinceID;
+    Entry->Text.Ptr = ArenaString(&E->Arena, Temp->Len > 0 ? Temp->Ptr : "", (int)Temp->Len);
+    Entry->Text.Len = (int)Temp->Len;
+    E->NumExpansions++;
+    E->Stats.StringExpansions++;
+}
+
+// Fill the expansion cache with everything the Modifications to be rendered
+// need. It's only read while rendering, so the threads can share it.
+static void MakeExpansions(Empire *E)
+{
+    const ProvinceGroup *Group;
+    GrowBuf Temp;
+    IRItem *Item;
+    int Event, t, p;
+
+    memset(&Temp, 0, sizeof(Temp));
+    for (t=0; t<E->NumTasks; t++) {
+        Item = &E->Items[E->Tasks[t]];
+        Event = Item->Event;
+        Group = Item->Group >= 0 ? &E->ProvinceGroups[Item->Group] : NULL;
+        for (p=Group != NULL ? NextInGroup(Group, 0) : Item->ProvinceID; p>0;
+             p=Group != NULL ? NextInGroup(Group, p) : 0) {
+            if (E->Sections[Item->Section].Dirty) {
+                AddExpansion(E, &Temp, Item->Trigger, p);
+            }
+            if (E->Sections[Item->ModSection].Dirty) {
+                AddExpansion(E, &Temp, E->EventData[Event][1], p);
+                AddExpansion(E, &Temp, E->EventData[Event][2], p);
+                AddExpansion(E, &Temp, E->EventData[Event][3], p);
+            }
+        }
+    }
+    BufFree(&Temp);
+}
+
+static StrView GetExpansion(Empire *E, int Slot, int ProvinceID)
+{
+    return(FindExpansion(E, Slot, ProvinceID)->Text);
+}
+
+static void FreeExpansions(Empire *E)
+{
+    free(E->Expansions);
+    E->Expansions = NULL;
+    E->ExpansionsSize = E->NumExpansions = 0;
+}
+
+// Functions rendering the events for a Modification: the modification
+// event itself goes to the mod file, and the RNGC events deciding whether
+// it happens go to the output file.
+// Any chance can be generated using ai_chance, so a Modification needs one
+// RNGC event per distinct probability, with the Small/Normal/Large flags
+// picking which of them applies.
+static void RenderModEvent(Empire *E, IRItem *Item, int ProvinceID, int ModID, GrowBuf *Out)
+{
+    int Event = Item->Event;
+    TemplateArgs Args;
+
+    // Check that we actually have something to do...
+    if (ModID == INT_MAX) {
+        return;
+    }
+    Args.Num[PH_PROVINCE_ID] = ProvinceID;
+    SetStr(&Args, PH_PROVINCE_NAME, E->Provinces->Names[ProvinceID], (int)strlen(E->Provinces->Names[ProvinceID]));
+    Args.Num[PH_EVENT_ID] = ModID;
+    Args.Num[PH_MOD_EVENT_ID] = ModID;
+    // The name, description and command with the province filled in.
+    Args.Str[PH_NAME] = GetExpansion(E, E->EventData[Event][1], ProvinceID);
+    Args.Str[PH_DESC] = GetExpansion(E, E->EventData[Event][2], ProvinceID);
+    Args.Str[PH_COMMAND] = GetExpansion(E, E->EventData[Event][3], ProvinceID);
+    EmitTemplate(Out, &E->TemplateSets[Item->Templates].Templates[TEMPLATE_MOD], &Args);
+}
+
+// The template of the RNGC event for a chance.
+static int RNGCTemplate(int Chance)
+{
+    if (Chance == 100) {
+        return(TEMPLATE_RNGC_100P);
+    } else if (Chance <= LOW_CHANCE_THRESHOLD) {
+        return(TEMPLATE_RNGC_LOW);
+    }
+    return(TEMPLATE_RNGC);
+}
+
+static void RenderRNGCEvents(Empire *E, RenderState *State, IRItem *Item, int ProvinceID, int ModID, GrowBuf *Out)
+{
+    int Event = Item->Event;
+    int Small = Item->Small, Normal = Item->Normal, Large = Item->Large;
+    int ID1 = ModID, Target, NumEvents, Chances[3], Groups[3], i;
+    const TemplateSet *Set = &E->TemplateSets[Item->Templates];
+    const StrView *Flag;
+    TemplateArgs Args;
+
+    // Check that we actually have something to do...
+    if (ModID == INT_MAX) {
+        return;
+    }
+    SetStr(&Args, PH_START_DATE, Item->StartText.Ptr, Item->StartText.Len);
+    SetStr(&Args, PH_END_DATE, Item->EndText.Ptr, Item->EndText.Len);
+    // The arguments shared by all the RNGC events.
+    Args.Num[PH_PROVINCE_ID] = ProvinceID;
+    SetStr(&Args, PH_PROVINCE_NAME, E->Provinces->Names[ProvinceID], (int)strlen(E->Provinces->Names[ProvinceID]));
+    Args.Num[PH_MOD_EVENT_ID] = ModID;
+    Args.Str[PH_TRIGGER] = GetExpansion(E, Item->Trigger, ProvinceID);
+    SetStr(&Args, PH_COUNTRY, E->TagArray[E->RNGCTag], (int)strlen(E->TagArray[E->RNGCTag]));
+    Args.Num[PH_OFFSET] = Item->Offset;
+    // Generate the RNGC events, one per distinct chance, their IDs follow
+    // the modification event's.
+    NumEvents = GroupChances(Small, Normal, Large, Chances, Groups);
+    for (i=0; i<NumEvents; i++) {
+        Target = Chances[i];
+        Flag = &E->FlagStrings[Event][Groups[i]];
+        ID1++;
+        Args.Num[PH_EVENT_ID] = ID1;
+        SetStr(&Args, PH_FLAG, Flag->Ptr, Flag->Len);
+        Args.Num[PH_CHANCE] = Target;
+        Args.Num[PH_NO_CHANCE] = 100 - Target;
+        EmitTemplate(Out, &Set->Templates[RNGCTemplate(Target)], &Args);
+    }
+    State->Stats.RNGCEvents += NumEvents;
+    if (NumEvents > State->Stats.MaxRNGCEvents) {
+        State->Stats.MaxRNGCEvents = NumEvents;
+    }
+}
+
+// The Modifications are rendered into per-Modification buffers before
+// the output files are put together, optionally spread over several threads
+// (EmpireSetThreads). The buffers are then used in source order, so the
+// output is the same whatever the number of threads.
+typedef struct RenderedItem {
+    GrowBuf RNGCText;
+    GrowBuf ModText;
+    size_t RNGCFullLen, ModFullLen; // The lengths before compacting.
+} RenderedItem;
+
+// Compact output (EmpireSetCompact): the events without comments and
+// optional whitespace. Outside quoted strings comments are dropped, and a
+// run of whitespace becomes a newline after a top level block, a space
+// where it keeps two words apart, and nothing next to '=', '{' and '}'.
+// The result is never longer than In.
+static void CompactText(const GrowBuf *In, GrowBuf *Out)
+{
+    const char *p = In->Ptr, *End = In->Ptr + In->Len;
+    char *q;
+    int c, Space = 0, Depth = 0;
+
+    Out->Len = 0;
+    BufReserve(Out, In->Len);
+    q = Out->Ptr;
+    while (p < End) {
+        c = (unsigned char)*p++;
+        if (c == '#') {
+            while (p < End && *p != '\n' && *p != '\r') {
+                p++;
+            }
+            continue;
+        }
+        if (IsWhitespace(c)) {
+            Space = 1;
+            continue;
+        }
+        if (Space && q > Out->Ptr) {
+            if (Depth == 0 && q[-1] == '}') {
+                *q++ = '\n';
+            } else if (strchr("={}\n", q[-1]) == NULL && c != '=' && c != '{' && c != '}') {
+                *q++ = ' ';
+            }
+        }
+        Space = 0;
+        *q++ = (char)c;
+        if (c == '"') {
+            // Strings are copied as they are.
+            while (p < End && *p != '"') {
+                *q++ = *p++;
+            }
+            if (p < End) {
+                *q++ = *p++;
+            }
+        } else if (c == '{') {
+            Depth++;
+        } else if (c == '}' && Depth > 0) {
+            Depth--;
+        }
+    }
+    if (Space && q > Out->Ptr && Depth == 0 && q[-1] == '}') {
+        *q++ = '\n';
+    }
+    Out->Len = q - Out->Ptr;
+}
+
+// Replace Text with its compacted version, remembering the full length.
+static void CompactRendered(RenderState *State, GrowBuf *Text, size_t *FullLen)
+{
+    GrowBuf Temp;
+
+    *FullLen = Text->Len;
+    if (Text->Len == 0) {
+        return;
+    }
+    CompactText(Text, &State->Compacted);
+    Temp = *Text;
+    *Text = State->Compacted;
+    State->Compacted = Temp;
+}
+
+// Tracing: a thread's span ends when it moves on to the Modifications of
+// another OutputFile section.
+static void TraceSection(Empire *E, RenderState *State, int Section)
+{
+    EmpireSpan *Span;
+    double Now;
+
+    if (State->SpanOpen && State->SpanSection == Section) {
+        return;
+    }
+    Now = EmpireClock();
+    if (State->SpanOpen) {
+        State->Spans[State->NumSpans - 1].End = Now;
+    }
+    if (State->NumSpans >= State->SpansSize) {
+        State->SpansSize = State->SpansSize > 0 ? State->SpansSize * 2 : 16;
+        State->Spans = MemRealloc(State->Spans, State->SpansSize * sizeof(EmpireSpan));
+    }
+    Span = &State->Spans[State->NumSpans++];
+    Span->FileName = E->Sections[Section].FileName;
+    Span->Line = E->Sections[Section].Line;
+    Span->Thread = State->Thread;
+    Span->Start = Now;
+    State->SpanOpen = 1;
+    State->SpanSection = Section;
+}
+
+// Add what a thread counted and traced to the context.
+static void MergeRenderState(Empire *E, RenderState *State)
+{
+    if (State->SpanOpen) {
+        State->Spans[State->NumSpans - 1].End = EmpireClock();
+        State->SpanOpen = 0;
+    }
+    E->Stats.Modifications += State->Stats.Modifications;
+    E->Stats.RNGCEvents += State->Stats.RNGCEvents;
+    if (State->Stats.MaxRNGCEvents > E->Stats.MaxRNGCEvents) {
+        E->Stats.MaxRNGCEvents = State->Stats.MaxRNGCEvents;
+    }
+    if (State->NumSpans > 0) {
+        E->Spans = MemRealloc(E->Spans, (E->NumSpans + State->NumSpans) * sizeof(EmpireSpan));
+        memcpy(&E->Spans[E->NumSpans], State->Spans, State->NumSpans * sizeof(EmpireSpan));
+        E->NumSpans += State->NumSpans;
+    }
+}
+
+static void RenderTask(Empire *E, RenderState *State, int Task)
+{
+    int i = E->Tasks[Task], k, p;
+    IRItem *Item = &E->Items[i];
+    const ProvinceGroup *Group;
+
+    if (E->Tracing) {
+        TraceSection(E, State, E->Items[i].Section);
+    }
+    if (Item->Group < 0) {
+        State->Stats.Modifications++;
+        if (E->Sections[Item->Section].Dirty) {
+            RenderRNGCEvents(E, State, Item, Item->ProvinceID, Item->ModID, &E->Rendered[i].RNGCText);
+        }
+        if (E->Sections[Item->ModSection].Dirty) {
+            RenderModEvent(E, Item, Item->ProvinceID, Item->ModID, &E->Rendered[i].ModText);
+        }
+    } else {
+        // A ProvinceGroup renders as the Modifications of its provinces would.
+        Group = &E->ProvinceGroups[Item->Group];
+        State->Stats.Modifications += Group->NumProvinces;
+        if (E->Sections[Item->Section].Dirty) {
+            for (k=0, p=NextInGroup(Group, 0); p>0; k++, p=NextInGroup(Group, p)) {
+                RenderRNGCEvents(E, State, Item, p, Item->ModIDs[k], &E->Rendered[i].RNGCText);
+            }
+        }
+        if (E->Sections[Item->ModSection].Dirty) {
+            for (k=0, p=NextInGroup(Group, 0); p>0; k++, p=NextInGroup(Group, p)) {
+                RenderModEvent(E, Item, p, Item->ModIDs[k], &E->Rendered[i].ModText);
+            }
+        }
+    }
+    if (E->Compact && E->Sections[Item->Section].Dirty) {
+        CompactRendered(State, &E->Rendered[i].RNGCText, &E->Rendered[i].RNGCFullLen);
+    }
+    if (E->Compact && E->Sections[Item->ModSection].Dirty) {
+        CompactRendered(State, &E->Rendered[i].ModText, &E->Rendered[i].ModFullLen);
+    }
+}
+
+#ifndef _WIN32
+// Work-stealing pool. The tasks start out split into one contiguous range
+// per worker. A worker takes tasks from the front of its own range, and
+// when that runs dry it steals the back half of the largest range left.
+typedef struct WorkQueue {
+    pthread_mutex_t Lock;
+    int Next, End; // The tasks left in this worker's range.
+} WorkQueue;
+
+typedef struct {
+    Empire *E;
+    int Worker;
+    RenderState State;
+} WorkerArgs;
+
+// Returns the next task for Worker, or -1 when there's nothing left.
+static int GetTask(Empire *E, int Worker)
+{
+    WorkQueue *Own = &E->Queues[Worker], *Victim;
+    int i, Best, BestLeft, Left, Take, Task;
+
+    while (1) {
+        pthread_mutex_lock(&Own->Lock);
+        if (Own->Next < Own->End) {
+            Task = Own->Next++;
+            pthread_mutex_unlock(&Own->Lock);
+            return(Task);
+        }
+        pthread_mutex_unlock(&Own->Lock);
+        // Find the fullest queue.
+        Best = -1;
+        BestLeft = 0;
+        for (i=0; i<E->NumThreads; i++) {
+            if (i == Worker) {
+                continue;
+            }
+            pthread_mutex_lock(&E->Queues[i].Lock);
+            Left = E->Queues[i].End - E->Queues[i].Next;
+            pthread_mutex_unlock(&E->Queues[i].Lock);
+            if (Left > BestLeft) {
+                Best = i;
+                BestLeft = Left;
+            }
+        }
+        if (Best < 0) {
+            return(-1);
+        }
+        Victim = &E->Queues[Best];
+        pthread_mutex_lock(&Victim->Lock);
+        Left = Victim->End - Victim->Next;
+        if (Left <= 0) {
+            // Someone else got there first, look again.
+            pthread_mutex_unlock(&Victim->Lock);
+            continue;
+        }
+        Take = (Left + 1) / 2;
+        Victim->End -= Take;
+        Task = Victim->End;
+        pthread_mutex_unlock(&Victim->Lock);
+        // Our own range is empty, so nobody steals from it meanwhile.
+        pthread_mutex_lock(&Own->Lock);
+        Own->Next = Task + 1;
+        Own->End = Task + Take;
+        pthread_mutex_unlock(&Own->Lock);
+        return(Task);
+    }
+}
+
+static void *WorkerMain(void *Arg)
+{
+    WorkerArgs *Args = Arg;
+    int Task;
+
+    while ((Task = GetTask(Args->E, Args->Worker)) >= 0) {
+        RenderTask(Args->E, &Args->State, Task);
+    }
+    return(NULL);
+}
+#endif
+
+// Make the flag conditions of each EventData, for every group of versions.
+static void MakeFlagStrings(Empire *E)
+{
+    static const char *Formats[8] = {
+        "", "\t\tflag = Small%s\n", "\t\tflag = Normal%s\n", "\t\tNOT = { flag = Large%s }\n",
+        "\t\tflag = Large%s\n", "\t\tNOT = { flag = Normal%s }\n", "\t\tNOT = { flag = Small%s }\n", ""
+    };
+    GrowBuf Temp;
+    int i, g;
+
+    if (E->FlagStrings != NULL) {
+        return;
+    }
+    memset(&Temp, 0, sizeof(Temp));
+    E->FlagStrings = MemAlloc((E->EventDataIndex > 0 ? E->EventDataIndex : 1) * sizeof(E->FlagStrings[0]));
+    for (i=0; i<E->EventDataIndex; i++) {
+        for (g=0; g<8; g++) {
+            FormatString(&Temp, Formats[g], E->TagArray[E->EventData[i][0]]);
+            E->FlagStrings[i][g].Ptr = ArenaString(&E->Arena, Temp.Ptr, (int)Temp.Len);
+            E->FlagStrings[i][g].Len = (int)Temp.Len;
+        }
+    }
+    BufFree(&Temp);
+}
+
+// Change any occurance of feb 29 or feb 30 to mar 1.
+static int FixDate(int Date)
+{
+    if (Date % 10000 == 229 || Date % 10000 == 230) {
+        return((Date / 10000) * 10000 + 301);
+    }
+    return(Date);
+}
+
+// Convert the dates of the Modifications to be rendered to EU II format
+// event date strings, and work out their event offsets. Most Modifications
+// share a handful of dates, so each date is only formatted once.
+static void MakeDateStrings(Empire *E)
+{
+    IDTable Dates;
+    IDSlot *Slot;
+    StrView *Texts = NULL;
+    GrowBuf Temp;
+    IRItem *Item;
+    int NumTexts = 0, TextsSize = 0, Date, t, i;
+
+    memset(&Dates, 0, sizeof(Dates));
+    memset(&Temp, 0, sizeof(Temp));
+    for (t=0; t<E->NumTasks; t++) {
+        Item = &E->Items[E->Tasks[t]];
+        for (i=0; i<2; i++) {
+            Date = FixDate(i == 0 ? Item->StartDate : Item->EndDate);
+            Slot = AddID(&Dates, Date);
+            if (Slot->Value < 0) {
+                Temp.Len = 0;
+                BufAppend(&Temp, "year = ", 7);
+                BufAppendInt(&Temp, Date / 10000);
+                BufAppend(&Temp, " month = ", 9);
+                BufAppend(&Temp, StrMonth[(Date / 100) % 100], strlen(StrMonth[(Date / 100) % 100]));
+                BufAppend(&Temp, " day = ", 7);
+                BufAppendInt(&Temp, Date % 100);
+                if (NumTexts >= TextsSize) {
+                    TextsSize = TextsSize > 0 ? TextsSize * 2 : 64;
+                    Texts = MemRealloc(Texts, TextsSize * sizeof(StrView));
+                }
+                Texts[NumTexts].Ptr = ArenaString(&E->Arena, Temp.Ptr, (int)Temp.Len);
+                Texts[NumTexts].Len = (int)Temp.Len;
+                Slot->Value = NumTexts++;
+            }
+            if (i == 0) {
+                Item->StartText = Texts[Slot->Value];
+            } else {
+                Item->EndText = Texts[Slot->Value];
+            }
+        }
+        Item->Offset = CalcDateSpan(FixDate(Item->StartDate), FixDate(Item->EndDate));
+    }
+    free(Dates.Slots);
+    free(Texts);
+    BufFree(&Temp);
+}
+
+// Render all Modifications.
+static void RenderModifications(Empire *E)
+{
+    RenderState State;
+    int i;
+#ifndef _WIN32
+    WorkerArgs *Args;
+    pthread_t *Threads;
+    int Started;
+#endif
+
+    MakeFlagStrings(E);
+    E->Rendered = MemCalloc(E->NumItems, sizeof(RenderedItem));
+    E->Tasks = MemAlloc(E->NumItems * sizeof(int));
+    E->NumTasks = 0;
+    for (i=0; i<E->NumItems; i++) {
+        if (E->Items[i].Kind == ITEM_MODIFICATION && E->Items[i].ModID != INT_MAX &&
+            (E->Sections[E->Items[i].Section].Dirty || E->Sections[E->Items[i].ModSection].Dirty)) {
+            E->Tasks[E->NumTasks++] = i;
+        }
+    }
+    MakeDateStrings(E);
+    MakeExpansions(E);
+#ifndef _WIN32
+    if (E->NumThreads > 1 && E->NumTasks > 1) {
+        E->Queues = MemAlloc(E->NumThreads * sizeof(WorkQueue));
+        Args = MemCalloc(E->NumThreads, sizeof(WorkerArgs));
+        Threads = MemAlloc(E->NumThreads * sizeof(pthread_t));
+        for (i=0; i<E->NumThreads; i++) {
+            pthread_mutex_init(&E->Queues[i].Lock, NULL);
+            E->Queues[i].Next = (int)((long long)E->NumTasks * i / E->NumThreads);
+            E->Queues[i].End = (int)((long long)E->NumTasks * (i + 1) / E->NumThreads);
+            Args[i].E = E;
+            Args[i].Worker = i;
+            Args[i].State.Thread = i;
+        }
+        // The main thread is worker 0.
+        Started = 1;
+        for (i=1; i<E->NumThreads; i++) {
+            if (pthread_create(&Threads[i], NULL, WorkerMain, &Args[i]) != 0) {
+                // The others will steal its work.
+                break;
+            }
+            Started++;
+        }
+        WorkerMain(&Args[0]);
+        for (i=1; i<Started; i++) {
+            pthread_join(Threads[i], NULL);
+        }
+        for (i=0; i<E->NumThreads; i++) {
+            pthread_mutex_destroy(&E->Queues[i].Lock);
+            MergeRenderState(E, &Args[i].State);
+            FreeRenderState(&Args[i].State);
+        }
+        free(Threads);
+        free(Args);
+        free(E->Queues);
+        E->Queues = NULL;
+        return;
+    }
+#endif
+    memset(&State, 0, sizeof(State));
+    for (i=0; i<E->NumTasks; i++) {
+        RenderTask(E, &State, i);
+    }
+    MergeRenderState(E, &State);
+    FreeRenderState(&State);
+}
+
+// Read province.csv, for the province names. Returns the number of errors.
+int EmpireLoadProvinces(Empire *E, const char *FileName, const char *Buf, size_t Len)
+{
+    EmpireProvinces *Provinces;
+    int Num, Char, Errors = E->NumErrors;
+    const char *Field;
+
+    // Start from an empty table, the old one may be shared.
+    Provinces = MemCalloc(1, sizeof(EmpireProvinces));
+    EmpireSetProvinces(E, Provinces);
+    SetInput(E, FileName, Buf, Len);
+    if (GetChar(E) == 'I' && GetChar(E) == 'd' && GetChar(E) == ';' &&
+        GetChar(E) == 'N' && GetChar(E) == 'a' && GetChar(E) == 'm' &&
+        GetChar(E) == 'e' && GetChar(E) == ';') {
+        // Looks like a province.csv file.
+        SkipRestOfLine(E);
+        while (1) {
+            Num = GetNum(E);
+            if (Num == -1) {
+                // End marker.
+                break;
+            }
+            if (Num < 0 || Num > MAX_PROVINCE_ID) {
+                Error(E, "province ID out of range, aborting", 0);
+                break;
+            }
+            Char = GetChar(E);
+            if ((char)Char != ';') {
+                Error(E, "expected ';'", Char);
+                UnGetChar(E, Char);
+            }
+            // The name is everything up to the next ';'.
+            Field = memchr(E->InPos, ';', E->InEnd - E->InPos);
+            if (Field == NULL) {
+                Field = E->InEnd;
+            }
+            SetProvinceName(E, Num, E->InPos, (int)(Field - E->InPos));
+            E->LineNumber += CountLines(E->InPos, Field);
+            E->InPos = Field < E->InEnd ? Field + 1 : E->InEnd;
+            if (Num > E->Provinces->Largest) {
+                E->Provinces->Largest = Num;
+            }
+            SkipRestOfLine(E);
+        }
+    } else {
+        Error(E, "the province file doesn't look like an EU II province.csv file", 0);
+    }
+    // All done with the province file.
+    E->InBuf = E->InPos = E->InEnd = NULL;
+    return(E->NumErrors - Errors);
+}
+
+// The compiled province index: the names loaded from a province.csv, laid
+// out so that they can be used straight from a mapped file. The header is
+// followed by one offset into the names per province ID, then the names,
+// null terminated. Province IDs without a name share the empty string at
+// the start of the names.
+#define PROVINCE_INDEX_MAGIC "EMPIDX1"
+#define PROVINCE_INDEX_BYTE_ORDER 0x01020304
+
+typedef struct {
+    char Magic[8];
+    unsigned int ByteOrder;   // PROVINCE_INDEX_BYTE_ORDER, as written by this machine.
+    unsigned int NumNames;    // The largest province ID + 1.
+    long long Size, MTime;    // Identify the province.csv, see EmpireSaveProvinceIndex.
+    unsigned int NamesSize;   // The size of all the names.
+    unsigned int Unused;
+} ProvinceIndexHeader;
+
+char *EmpireSaveProvinceIndex(Empire *E, long long Size, long long MTime, size_t *Len)
+{
+    EmpireProvinces *Provinces = E->Provinces;
+    ProvinceIndexHeader Header;
+    unsigned int *Offsets;
+    char *Buf, *Names;
+    size_t NameLen;
+    int i;
+
+    memset(&Header, 0, sizeof(Header));
+    memcpy(Header.Magic, PROVINCE_INDEX_MAGIC, sizeof(Header.Magic));
+    Header.ByteOrder = PROVINCE_INDEX_BYTE_ORDER;
+    Header.NumNames = Provinces->Size > 0 ? Provinces->Largest + 1 : 0;
+    Header.Size = Size;
+    Header.MTime = MTime;
+    Header.NamesSize = 1;
+    for (i=0; i<(int)Header.NumNames; i++) {
+        if (Provinces->Names[i][0] != 0) {
+            Header.NamesSize += (unsigned int)strlen(Provinces->Names[i]) + 1;
+        }
+    }
+    *Len = sizeof(Header) + Header.NumNames * sizeof(unsigned int) + Header.NamesSize;
+    Buf = MemAlloc(*Len);
+    memcpy(Buf, &Header, sizeof(Header));
+    Offsets = (unsigned int *)(Buf + sizeof(Header));
+    Names = (char *)(Offsets + Header.NumNames);
+    Names[0] = 0;
+    NameLen = 1;
+    for (i=0; i<(int)Header.NumNames; i++) {
+        if (Provinces->Names[i][0] == 0) {
+            Offsets[i] = 0;
+            continue;
+        }
+        Offsets[i] = (unsigned int)NameLen;
+        strcpy(Names + NameLen, Provinces->Names[i]);
+        NameLen += strlen(Provinces->Names[i]) + 1;
+    }
+    return(Buf);
+}
+
+int EmpireLoadProvinceIndex(Empire *E, const char *Buf, size_t Len, long long Size, long long MTime)
+{
+    const ProvinceIndexHeader *Header = (const ProvinceIndexHeader *)Buf;
+    const unsigned int *Offsets;
+    EmpireProvinces *Provinces;
+    const char *Names;
+    unsigned int i;
+
+    // Check that it's an index for this province.csv, and that nothing
+    // points outside it.
+    if (Len < sizeof(ProvinceIndexHeader) || memcmp(Header->Magic, PROVINCE_INDEX_MAGIC, sizeof(Header->Magic)) != 0 ||
+        Header->ByteOrder != PROVINCE_INDEX_BYTE_ORDER || Header->Size != Size || Header->MTime != MTime ||
+        Header->NumNames > MAX_PROVINCE_ID + 1 || Header->NamesSize == 0 ||
+        Len != sizeof(ProvinceIndexHeader) + Header->NumNames * sizeof(unsigned int) + Header->NamesSize) {
+        return(-1);
+    }
+    Offsets = (const unsigned int *)(Buf + sizeof(ProvinceIndexHeader));
+    Names = (const char *)(Offsets + Header->NumNames);
+    if (Names[Header->NamesSize - 1] != 0) {
+        return(-1);
+    }
+    for (i=0; i<Header->NumNames; i++) {
+        if (Offsets[i] >= Header->NamesSize) {
+            return(-1);
+        }
+    }
+    Provinces = MemCalloc(1, sizeof(EmpireProvinces));
+    Provinces->Size = (int)Header->NumNames;
+    Provinces->Largest = Header->NumNames > 0 ? (int)Header->NumNames - 1 : 0;
+    Provinces->Names = MemAlloc(Header->NumNames * sizeof(char *));
+    for (i=0; i<Header->NumNames; i++) {
+        Provinces->Names[i] = Names + Offsets[i];
+    }
+    EmpireSetProvinces(E, Provinces);
+    return(0);
+}
+
+// The registry is saved as text: a "file <data file>" line for each data
+// file, followed by the IDs it has as ranges, "<first> <last>" a line.
+static int CompareOwnedIDs(const void *a, const void *b)
+{
+    const IDSlot *x = a, *y = b;
+
+    if (x->Value != y->Value) {
+        return(x->Value < y->Value ? -1 : 1);
+    }
+    return(x->ID < y->ID ? -1 : x->ID > y->ID);
+}
+
+char *EmpireSaveIDRegistry(EmpireIDRegistry *R, size_t *Len)
+{
+    IDSlot *Owned;
+    GrowBuf Out;
+    int i, j, n = 0;
+
+    Owned = MemAlloc((R->IDs.Used > 0 ? R->IDs.Used : 1) * sizeof(IDSlot));
+    for (i=0; i<R->IDs.Size; i++) {
+        if (R->IDs.Slots[i].ID != 0 && R->IDs.Slots[i].Value >= 0) {
+            Owned[n++] = R->IDs.Slots[i];
+        }
+    }
+    qsort(Owned, n, sizeof(IDSlot), CompareOwnedIDs);
+    memset(&Out, 0, sizeof(Out));
+    BufAppend(&Out, "# Empire event ID registry\n", 27);
+    for (i=0; i<n; i=j) {
+        if (i == 0 || Owned[i].Value != Owned[i - 1].Value) {
+            BufAppend(&Out, "file ", 5);
+            BufAppend(&Out, R->Owners[Owned[i].Value], strlen(R->Owners[Owned[i].Value]));
+            BufAppend(&Out, "\n", 1);
+        }
+        for (j=i+1; j<n && Owned[j].Value == Owned[i].Value && Owned[j].ID == Owned[j - 1].ID + 1; j++) {
+        }
+        BufAppendInt(&Out, Owned[i].ID);
+        BufAppend(&Out, " ", 1);
+        BufAppendInt(&Out, Owned[j - 1].ID);
+        BufAppend(&Out, "\n", 1);
+    }
+    free(Owned);
+    *Len = Out.Len;
+    return(Out.Ptr);
+}
+
+int EmpireLoadIDRegistry(EmpireIDRegistry *R, const char *Buf, size_t Len)
+{
+    const char *p = Buf, *End = Buf + Len, *Line;
+    char Temp[64], *Name;
+    int LineLen, Owner = -1, First, Last, Used, Bad = 0, i;
+
+    while (p < End) {
+        Line = p;
+        while (p < End && *p != '\n') {
+            p++;
+        }
+        LineLen = (int)(p - Line);
+        p++;
+        if (LineLen > 0 && Line[LineLen - 1] == '\r') {
+            LineLen--;
+        }
+        if (LineLen == 0 || Line[0] == '#') {
+            continue;
+        }
+        if (LineLen > 5 && memcmp(Line, "file ", 5) == 0) {
+            Name = MemAlloc(LineLen - 4);
+            memcpy(Name, Line + 5, LineLen - 5);
+            Name[LineLen - 5] = 0;
+            Owner = GetOwner(R, Name);
+            free(Name);
+            continue;
+        }
+        if (LineLen >= (int)sizeof(Temp)) {
+            Bad = 1;
+            break;
+        }
+        memcpy(Temp, Line, LineLen);
+        Temp[LineLen] = 0;
+        if (Owner < 0 || sscanf(Temp, "%d %d%n", &First, &Last, &Used) != 2 || Used != LineLen ||
+            First <= 0 || Last < First || Last - First > 1000000) {
+            Bad = 1;
+            break;
+        }
+        for (i=First; i<=Last; i++) {
+            AddID(&R->IDs, i)->Value = Owner;
+        }
+    }
+    if (Bad) {
+        // Not a registry, forget what was read.
+        for (i=0; i<R->IDs.Size; i++) {
+            R->IDs.Slots[i].Value = -1;
+        }
+        return(-1);
+    }
+    return(0);
+}
+
+// The arguments of a ProvinceGroup, after the group tag: province IDs and
+// earlier groups to add, or with a '-' in front to remove, in order.
+static void GetProvinceGroup(Empire *E, ProvinceGroup *Group)
+{
+    const ProvinceGroup *Other;
+    unsigned int Word;
+    int c, Remove, Num, Tag, g, i;
+
+    memset(Group, 0, sizeof(ProvinceGroup));
+    while (1) {
+        SkipWhitespacesAndComments(E);
+        c = PeekChar(E);
+        if (c == ')' || c == EOF) {
+            break;
+        }
+        Remove = 0;
+        if (c == '-') {
+            GetChar(E);
+            SkipWhitespacesAndComments(E);
+            c = PeekChar(E);
+            Remove = 1;
+        }
+        if (IsDigit(c)) {
+            Num = GetNum(E);
+            if (Num <= 0 || Num > E->Provinces->Largest) {
+                Error(E, "not a valid province", 0);
+            } else if (Remove) {
+                Group->Bits[Num / 32] &= ~(1u << (Num % 32));
+            } else {
+                Group->Bits[Num / 32] |= 1u << (Num % 32);
+            }
+        } else if (IsLetter(c)) {
+            Tag = GetTag(E);
+            g = GetBinding(E, Tag, BIND_GROUP);
+            if (g < 0) {
+                Error(E, "not a valid ProvinceGroup", 0);
+                continue;
+            }
+            Other = &E->ProvinceGroups[g];
+            for (i=0; i<GROUP_WORDS; i++) {
+                if (Remove) {
+                    Group->Bits[i] &= ~Other->Bits[i];
+                } else {
+                    Group->Bits[i] |= Other->Bits[i];
+                }
+            }
+        } else {
+            Error(E, "expected a province ID or ProvinceGroup tag", c);
+            break;
+        }
+    }
+    for (i=0; i<GROUP_WORDS; i++) {
+        for (Word=Group->Bits[i]; Word!=0; Word&=Word-1) {
+            Group->NumProvinces++;
+        }
+    }
+}
+
+// The parse phase: read the data file into the IR. The input has to stay
+// around afterwards, since the IR points into it.
+static void ParseDataFile(Empire *E, const char *FileName, const char *Buf, size_t Len)
+{
+    int Char, Ret, i, j;
+    int Num, Num2, Num3, Num4, Num5, Num6;
+    int TagID, TagID2, TagID3, TagID4, TagID5;
+    int Str, Str2, Str3, Str4, Group, IsGroup;
+    ProvinceGroup NewGroup;
+    IRItem *Item;
+
+    SetInput(E, FileName, Buf, Len);
+    TagID = GetTag(E);
+    // Verify the file ID tag.
+    if (TagID != TAG_FILE_ID) {
+        Error(E, "expected the ProvinceModificationDataFile tag", 0);
+        return;
+    }
+    TagID = GetTag(E);
+    while (1) {
+        switch (TagID) {
+            case TAG_FILE_ID:
+                Warning(E, "spurious ProvinceModificationDataFile tag", 0);
+                break;
+            case TAG_RNGC:
+                VerifyListStart(E);
+                E->RNGCTag = GetTag(E);
+                VerifyListEnd(E);
+                // We ought to verify that it's a valid EU II country tag.
+                break;
+            case TAG_EVENT_ID_PREFIX:
+                VerifyListStart(E);
+                Num = GetNum(E);
+                VerifyListEnd(E);
+                // Not sure what the exact requirements for the event numbers
+                // are, but to be on the safe side, make them positive numbers
+                // fitting a signed 32-bit integer, and stay clear of the
+                // lowest range. With the event numbering scheme used, we
+                // need six digits for ourselves.
+                if (Num < 1 || Num > 2146) {
+                    Error(E, "EventIDPrefix argument outside [1..2146]", 0);
+                } else {
+                    E->EventIDPrefix = Num;
+                }
+                break;
+            case TAG_OUTPUT_FILE:
+                VerifyListStart(E);
+                Ret = GetString(E);
+                VerifyListEnd(E);
+                if (Ret == 0) {
+                    // Start a new section, the file is written later on.
+                    E->CurSection = AddSection(E, InternLatestString(E), 0);
+                } else {
+                    E->CurSection = -1;
+                    Error(E, "no valid output file name", 0);
+                }
+                break;
+			case TAG_OUTPUT_FILE_MOD:
+                VerifyListStart(E);
+                Ret = GetString(E);
+                VerifyListEnd(E);
+                if (Ret == 0) {
+                    // Start a new section, it gets the current header.
+                    E->CurModSection = AddSection(E, InternLatestString(E), 1);
+                } else {
+                    E->CurModSection = -1;
+                    Error(E, "no valid output file name", 0);
+                }
+                break;
+            case TAG_EVENT_TEMPLATE:
+                VerifyListStart(E);
+                TagID2 = GetTag(E);
+                Ret = GetString(E);
+                VerifyListEnd(E);
+                for (i=0; i<NUM_TEMPLATES; i++) {
+                    if (TagID2 >= 0 && TagID2 < E->TagIndex && strcmp(E->TagArray[TagID2], TemplateNames[i]) == 0) {
+                        break;
+                    }
+                }
+                if (i >= NUM_TEMPLATES) {
+                    Error(E, "unknown EventTemplate name", 0);
+                } else if (Ret == 0) {
+                    SetTemplate(E, i, E->LatestString.Ptr, E->LatestString.Len);
+                }
+                break;
+			case TAG_OUTPUT_FILE_MOD_HEADER:
+                VerifyListStart(E);
+                Ret = GetString(E);
+                VerifyListEnd(E);
+                if (Ret == 0) {
+					E->OutputFileModHeader = InternLatestString(E);
+                } else {
+                    Error(E, "no valid string to set as header", 0);
+                }
+                break;
+            case TAG_SET_STRING:
+                VerifyListStart(E);
+                TagID2 = GetTag(E);
+                Ret = GetString(E);
+                VerifyListEnd(E);
+                if (TagID2 >= 0 && TagID2 < TAG_FIRST_USER_TAG) {
+                    Error(E, "can't SetString a keyword tag", 0);
+                }
+                if (TagID2 >= TAG_FIRST_USER_TAG && TagID2 < E->TagIndex && Ret == 0) {
+                    if (BindTag(E, TagID2, BIND_STRING, E->StringIndex) == 0) {
+                        // Valid user tag and string.
+                        if (E->StringIndex >= E->StringArraySize) {
+                            E->StringArraySize = E->StringArraySize > 0 ? E->StringArraySize * 2 : 64;
+                            E->StringArray = MemRealloc(E->StringArray, E->StringArraySize * sizeof(char *));
+                        }
+                        E->StringArray[E->StringIndex] = InternLatestString(E);
+                        E->StringIndex++;
+                    }
+                }
+                break;
+            case TAG_TARGET_STRING:
+                VerifyListStart(E);
+                Ret = GetString(E);
+                VerifyListEnd(E);
+                if (Ret == 0) {
+                    if (E->CurSection >= 0) {
+                        Item = AddItem(E, ITEM_TARGET_STRING);
+                        Item->Text = E->LatestString;
+                    } else {
+                        Error(E, "no valid output file", 0);
+                    }
+                } else {
+                    Error(E, "no valid string to output", 0);
+                }
+                break;
+            case TAG_START_CONDITION:
+                VerifyListStart(E);
+                Num = GetNum(E);
+                TagID2 = GetTag(E);
+                VerifyListEnd(E);
+                // Verify it for being a valid province (based on province.csv).
+                if (Num <= 0 || Num > E->Provinces->Largest) {
+                    Error(E, "not a valid province", 0);
+                }
+                // Check that the tag refers to a string set by the user.
+                Str = GetBinding(E, TagID2, BIND_STRING);
+                if (Str < 0) {
+                    Error(E, "undefined tag", 0);
+                }
+                if (E->CurSection >= 0) {
+                    if (Num > 0 && Num <= E->Provinces->Largest && Str >= 0) {
+                        Item = AddItem(E, ITEM_START_CONDITION);
+                        Item->ProvinceID = Num;
+                        Item->Str = Str;
+                    }
+                } else {
+                    Error(E, "no valid output file", 0);
+                }
+                break;
+            case TAG_EVENT_DATA:
+                VerifyListStart(E);
+                TagID2 = GetTag(E);
+                TagID3 = GetTag(E);
+                TagID4 = GetTag(E);
+                TagID5 = GetTag(E);
+                VerifyListEnd(E);
+                if (TagID2 >= 0 && TagID2 < TAG_FIRST_USER_TAG) {
+                    Error(E, "can't define a keyword tag", 0);
+                }
+                // Check that the tags refer to strings set by the user.
+                Str2 = GetBinding(E, TagID3, BIND_STRING);
+                if (Str2 < 0) {
+                    Error(E, "undefined name tag", 0);
+                }
+                Str3 = GetBinding(E, TagID4, BIND_STRING);
+                if (Str3 < 0) {
+                    Error(E, "undefined description tag", 0);
+                }
+                Str4 = GetBinding(E, TagID5, BIND_STRING);
+                if (Str4 < 0) {
+                    Error(E, "undefined command tag", 0);
+                }
+                if (TagID2 >= TAG_FIRST_USER_TAG && TagID2 < E->TagIndex &&
+                    Str2 >= 0 && Str3 >= 0 && Str4 >= 0) {
+                    if (BindTag(E, TagID2, BIND_EVENT_DATA, E->EventDataIndex) == 0) {
+                        if (E->EventDataIndex >= E->EventDataSize) {
+                            E->EventDataSize = E->EventDataSize > 0 ? E->EventDataSize * 2 : 16;
+                            E->EventData = MemRealloc(E->EventData, E->EventDataSize * sizeof(E->EventData[0]));
+                        }
+                        E->EventData[E->EventDataIndex][0] = TagID2;
+                        E->EventData[E->EventDataIndex][1] = Str2;
+                        E->EventData[E->EventDataIndex][2] = Str3;
+                        E->EventData[E->EventDataIndex][3] = Str4;
+                        E->EventDataIndex++;
+                    }
+                }
+                break;
+            case TAG_PROVINCE_GROUP:
+                VerifyListStart(E);
+                TagID2 = GetTag(E);
+                GetProvinceGroup(E, &NewGroup);
+                VerifyListEnd(E);
+                if (TagID2 >= 0 && TagID2 < TAG_FIRST_USER_TAG) {
+                    Error(E, "can't define a keyword tag", 0);
+                }
+                if (NewGroup.NumProvinces == 0) {
+                    Warning(E, "empty ProvinceGroup", 0);
+                }
+                if (BindTag(E, TagID2, BIND_GROUP, E->NumProvinceGroups) == 0) {
+                    if (E->NumProvinceGroups >= E->ProvinceGroupsSize) {
+                        E->ProvinceGroupsSize = E->ProvinceGroupsSize > 0 ? E->ProvinceGroupsSize * 2 : 16;
+                        E->ProvinceGroups = MemRealloc(E->ProvinceGroups, E->ProvinceGroupsSize * sizeof(ProvinceGroup));
+                    }
+                    E->ProvinceGroups[E->NumProvinceGroups++] = NewGroup;
+                }
+                break;
+            case TAG_MODIFICATION:
+                VerifyListStart(E);
+                // Either a province ID or a ProvinceGroup.
+                SkipWhitespacesAndComments(E);
+                Group = -1;
+                IsGroup = IsLetter(PeekChar(E));
+                if (IsGroup) {
+                    Group = GetBinding(E, GetTag(E), BIND_GROUP);
+                    Num = 0;
+                } else {
+                    Num = GetNum(E);
+                }
+                TagID2 = GetTag(E);
+                TagID3 = GetTag(E);
+                Num2 = GetDate(E);
+                Num3 = GetDate(E);
+                Num4 = GetNum(E);
+                Num5 = GetNum(E);
+                Num6 = GetNum(E);
+                VerifyListEnd(E);
+                // Verify it for being a valid province (based on province.csv).
+                if (IsGroup && Group < 0) {
+                    Error(E, "not a valid ProvinceGroup", 0);
+                } else if (!IsGroup && (Num <= 0 || Num > E->Provinces->Largest)) {
+                    Error(E, "not a valid province", 0);
+                }
+                // Check that we have a valid EventData.
+                i = GetBinding(E, TagID2, BIND_EVENT_DATA);
+                if (i < 0) {
+                    Error(E, "not a valid EventData", 0);
+                }
+                // Check that the tag refers to a string set by the user.
+                j = GetBinding(E, TagID3, BIND_STRING);
+                if (j < 0) {
+                    Error(E, "undefined trigger tag", 0);
+                }
+                if (!VerifyDate(Num2)) {
+                    Error(E, "invalid start date", 0);
+                }
+                if (!VerifyDate(Num3)) {
+                    Error(E, "invalid end date", 0);
+                }
+                if (Num2 > Num3) {
+                    Error(E, "start date larger than end date", 0);
+                }
+                if (Num4 < 0 || Num4 > 100 ||
+                    Num5 < 0 || Num5 > 100 ||
+                    Num6 < 0 || Num6 > 100) {
+                    Error(E, "probability outside [0..100]", 0);
+                }
+                if (E->CurSection < 0) {
+                    Error(E, "no valid output file", 0);
+                } else if (E->CurModSection < 0) {
+                    Error(E, "no valid OutputFileMod file", 0);
+                } else if ((IsGroup ? Group >= 0 : Num > 0 && Num <= E->Provinces->Largest) &&
+                           i >= 0 && j >= 0 &&
+                           VerifyDate(Num2) && VerifyDate(Num3) && Num2 <= Num3 &&
+                           Num4 >= 0 && Num4 <= 100 &&
+                           Num5 >= 0 && Num5 <= 100 &&
+                           Num6 >= 0 && Num6 <= 100) {
+                    Item = AddItem(E, ITEM_MODIFICATION);
+                    Item->ProvinceID = Num;
+                    Item->Group = Group;
+                    Item->Event = i;
+                    Item->Trigger = j;
+                    Item->StartDate = Num2;
+                    Item->EndDate = Num3;
+                    Item->Small = Num4;
+                    Item->Normal = Num5;
+                    Item->Large = Num6;
+                }
+                break;
+            case TAG_END_OF_DATA:
+                // All done, but check for any spurios data.
+                SkipWhitespacesAndComments(E);
+                Char = GetChar(E);
+                if (Char != EOF) {
+                    Warning(E, "ignoring spurious data after EndOfData tag", Char);
+                }
+                return;
+            case INT_MAX:
+                // Not a tag.
+                Error(E, "not a valid tag", 0);
+                Char = GetChar(E);
+                if (Char == EOF) {
+                    Error(E, "end of file before EndOfdata tag", 0);
+                    return;
+                } else {
+                    UnGetChar(E, Char);
+                }
+                break;
+            default:
+                // User tag.
+                Error(E, "not a keyword tag", 0);
+                break;
+        }
+        if (E->NumErrors > 50) {
+            Error(E, "too many errors, aborting", 0);
+            return;
+        }
+        TagID = GetTag(E);
+    }
+}
+
+// Make the list of output files, from the last section written to each.
+static void MakeOutputs(Empire *E)
+{
+    OutputSection *Section;
+    EmpireOutput *Output;
+    int s;
+
+    E->Outputs = MemCalloc(E->NumSections, sizeof(EmpireOutput));
+    E->OutputSections = MemAlloc(E->NumSections * sizeof(int));
+    E->NumOutputs = 0;
+    for (s=0; s<E->NumSections; s++) {
+        Section = &E->Sections[s];
+        Section->Dirty = IsLastSection(E, s);
+        if (!Section->Dirty) {
+            continue;
+        }
+        Output = &E->Outputs[E->NumOutputs];
+        Output->FileName = Section->FileName;
+        Output->IsMod = Section->IsMod;
+        Output->Line = Section->Line;
+        Output->Hash = Section->Hash;
+        E->OutputSections[E->NumOutputs++] = s;
+    }
+}
+
+// A growable piece list, for building an output.
+typedef struct {
+    EmpirePiece *Pieces;
+    int NumPieces, Size;
+    size_t Len;
+} PieceList;
+
+static void AddPiece(PieceList *List, const char *Ptr, size_t Len)
+{
+    if (Len == 0) {
+        return;
+    }
+    if (List->NumPieces >= List->Size) {
+        List->Size = List->Size > 0 ? List->Size * 2 : 64;
+        List->Pieces = MemRealloc(List->Pieces, List->Size * sizeof(EmpirePiece));
+    }
+    List->Pieces[List->NumPieces].Ptr = Ptr;
+    List->Pieces[List->NumPieces].Len = Len;
+    List->NumPieces++;
+    List->Len += Len;
+}
+
+// Free what EmpireGenerate made.
+static void FreeGenerated(Empire *E)
+{
+    int i;
+
+    if (E->Rendered != NULL) {
+        for (i=0; i<E->NumItems; i++) {
+            BufFree(&E->Rendered[i].RNGCText);
+            BufFree(&E->Rendered[i].ModText);
+        }
+        free(E->Rendered);
+        E->Rendered = NULL;
+    }
+    for (i=0; i<E->NumOutputs; i++) {
+        free((void *)E->Outputs[i].Pieces);
+        E->Outputs[i].Pieces = NULL;
+        E->Outputs[i].NumPieces = 0;
+        E->Outputs[i].Len = E->Outputs[i].FullLen = 0;
+    }
+}
+
+// The generation phase: render the Modifications and put together the
+// output files from the IR.
+int EmpireGenerate(Empire *E)
+{
+    OutputSection *Section;
+    EmpireOutput *Output;
+    IRItem *Item;
+    PieceList List;
+    GrowBuf Temp;
+    size_t FullLen;
+    int o, i, Generated = 0;
+
+    if (!E->Parsed || E->NumErrors > 0) {
+        return(-1);
+    }
+    FreeGenerated(E);
+    // Only the parse counters are kept from a previous EmpireGenerate.
+    E->Stats.StringExpansions = E->Stats.Modifications = E->Stats.RNGCEvents = 0;
+    E->Stats.ExpansionCacheHits = 0;
+    E->Stats.MaxRNGCEvents = 0;
+    E->NumSpans = 0;
+    RenderModifications(E);
+    free(E->Tasks);
+    E->Tasks = NULL;
+    FreeExpansions(E);
+    memset(&Temp, 0, sizeof(Temp));
+    for (o=0; o<E->NumOutputs; o++) {
+        Output = &E->Outputs[o];
+        if (Output->Skip) {
+            continue;
+        }
+        Section = &E->Sections[E->OutputSections[o]];
+        memset(&List, 0, sizeof(List));
+        FullLen = 0;
+        if (Section->IsMod) {
+            // The header, then the modification events.
+            AddPiece(&List, Section->Header, strlen(Section->Header));
+            for (i=Section->FirstItem; i>=0; i=E->Items[i].NextMod) {
+                AddPiece(&List, E->Rendered[i].ModText.Ptr, E->Rendered[i].ModText.Len);
+                FullLen += E->Rendered[i].ModFullLen - E->Rendered[i].ModText.Len;
+            }
+        } else {
+            for (i=Section->FirstItem; i>=0; i=E->Items[i].Next) {
+                Item = &E->Items[i];
+                switch (Item->Kind) {
+                    case ITEM_TARGET_STRING:
+                        AddPiece(&List, Item->Text.Ptr, Item->Text.Len);
+                        break;
+                    case ITEM_START_CONDITION:
+                        FormatString(&Temp, "province = { id = %d %s }\n", Item->ProvinceID, E->StringArray[Item->Str]);
+                        E->Stats.StringExpansions++;
+                        AddPiece(&List, ArenaString(&E->Arena, Temp.Ptr, (int)Temp.Len), Temp.Len);
+                        break;
+                    case ITEM_MODIFICATION:
+                        AddPiece(&List, E->Rendered[i].RNGCText.Ptr, E->Rendered[i].RNGCText.Len);
+                        FullLen += E->Rendered[i].RNGCFullLen - E->Rendered[i].RNGCText.Len;
+                        break;
+                }
+            }
+        }
+        Output->Pieces = List.Pieces;
+        Output->NumPieces = List.NumPieces;
+        Output->Len = List.Len;
+        Output->FullLen = E->Compact ? List.Len + FullLen : List.Len;
+        Generated++;
+    }
+    BufFree(&Temp);
+    return(Generated);
+}
+
+char *EmpireJoinOutput(const EmpireOutput *Output)
+{
+    char *Buf, *p;
+    int i;
+
+    Buf = p = MemAlloc(Output->Len + 1);
+    for (i=0; i<Output->NumPieces; i++) {
+        memcpy(p, Output->Pieces[i].Ptr, Output->Pieces[i].Len);
+        p += Output->Pieces[i].Len;
+    }
+    *p = 0;
+    return(Buf);
+}
+
+// Overlap analysis. The date windows of the Modifications are sorted by
+// province and start date, and swept with the list of windows still open:
+// each new window overlaps exactly those that haven't ended before it
+// starts, so the ones that have are dropped as they're met. That makes it
+// O(n log n) plus the overlaps found.
+typedef struct {
+    int Province, Start, End, Item;
+} ModSpan;
+
+static int CompareModSpans(const void *a, const void *b)
+{
+    const ModSpan *x = a, *y = b;
+
+    if (x->Province != y->Province) {
+        return(x->Province < y->Province ? -1 : 1);
+    }
+    if (x->Start != y->Start) {
+        return(x->Start < y->Start ? -1 : 1);
+    }
+    return(x->Item < y->Item ? -1 : x->Item > y->Item);
+}
+
+static void AddOverlap(Empire *E, const ModSpan *First, const ModSpan *Second)
+{
+    const IRItem *Item1 = &E->Items[First->Item], *Item2 = &E->Items[Second->Item];
+    EmpireOverlap *Overlap;
+
+    if (E->NumOverlaps >= E->OverlapsSize) {
+        E->OverlapsSize = E->OverlapsSize > 0 ? E->OverlapsSize * 2 : 64;
+        E->Overlaps = MemRealloc(E->Overlaps, E->OverlapsSize * sizeof(EmpireOverlap));
+    }
+    Overlap = &E->Overlaps[E->NumOverlaps++];
+    Overlap->ProvinceID = First->Province;
+    Overlap->Line1 = Item1->Line;
+    Overlap->Line2 = Item2->Line;
+    Overlap->EventData1 = E->TagArray[E->EventData[Item1->Event][0]];
+    Overlap->EventData2 = E->TagArray[E->EventData[Item2->Event][0]];
+    Overlap->Conflict = Item1->Event != Item2->Event;
+    Overlap->Start1 = First->Start;
+    Overlap->End1 = First->End;
+    Overlap->Start2 = Second->Start;
+    Overlap->End2 = Second->End;
+}
+
+int EmpireFindOverlaps(Empire *E)
+{
+    const ProvinceGroup *Group;
+    const IRItem *Item;
+    ModSpan *Spans;
+    int *Open;
+    int i, j, p, n = 0, NumOpen = 0, Kept;
+
+    E->NumOverlaps = 0;
+    if (!E->Parsed || E->NumErrors > 0) {
+        return(0);
+    }
+    // The Modifications that generate anything, a window for each province.
+    for (i=0; i<E->NumItems; i++) {
+        Item = &E->Items[i];
+        if (Item->Kind == ITEM_MODIFICATION && CountRNGCEvents(Item->Small, Item->Normal, Item->Large) > 0) {
+            n += Item->Group < 0 ? 1 : E->ProvinceGroups[Item->Group].NumProvinces;
+        }
+    }
+    Spans = MemAlloc((n > 0 ? n : 1) * sizeof(ModSpan));
+    Open = MemAlloc((n > 0 ? n : 1) * sizeof(int));
+    n = 0;
+    for (i=0; i<E->NumItems; i++) {
+        Item = &E->Items[i];
+        if (Item->Kind != ITEM_MODIFICATION || CountRNGCEvents(Item->Small, Item->Normal, Item->Large) == 0) {
+            continue;
+        }
+        Group = Item->Group < 0 ? NULL : &E->ProvinceGroups[Item->Group];
+        for (p=Group == NULL ? Item->ProvinceID : NextInGroup(Group, 0); p>0; p=Group == NULL ? 0 : NextInGroup(Group, p)) {
+            Spans[n].Province = p;
+            Spans[n].Start = Item->StartDate;
+            Spans[n].End = Item->EndDate;
+            Spans[n].Item = i;
+            n++;
+        }
+    }
+    qsort(Spans, n, sizeof(ModSpan), CompareModSpans);
+    for (i=0; i<n; i++) {
+        if (i > 0 && Spans[i].Province != Spans[i - 1].Province) {
+            NumOpen = 0;
+        }
+        for (j=Kept=0; j<NumOpen; j++) {
+            if (Spans[Open[j]].End >= Spans[i].Start) {
+                AddOverlap(E, &Spans[Open[j]], &Spans[i]);
+                Open[Kept++] = Open[j];
+            }
+        }
+        NumOpen = Kept;
+        Open[NumOpen++] = i;
+    }
+    free(Spans);
+    free(Open);
+    return(E->NumOverlaps);
+}
+
+const EmpireOverlap *EmpireGetOverlap(Empire *E, int i)
+{
+    return(&E->Overlaps[i]);
+}
+
+int EmpireEventIDLine(Empire *E, int ID)
+{
+    const IDSlot *Slot = FindID(&E->EventIDs, ID);
+
+    return(Slot != NULL && Slot->Value >= 0 ? Slot->Value : 0);
+}
+
+// Event files are only tokenized as far as needed to find the "id = N" of
+// each event: comments and strings are skipped, braces counted, and only an
+// id directly inside a top level block (event = { id = N ... }) counts, so
+// e.g. the province ids in commands don't.
+EmpireEventRef *EmpireScanEventIDs(const char *Buf, size_t Len, int *Num)
+{
+    const char *p = Buf, *End = Buf + Len, *Word;
+    EmpireEventRef *Refs = NULL;
+    int Size = 0, Depth = 0, Line = 1, IDLine;
+    long long ID;
+
+    *Num = 0;
+    while (p < End) {
+        if (*p == '\n') {
+            Line++;
+            p++;
+        } else if (*p == '#') {
+            while (p < End && *p != '\n') {
+                p++;
+            }
+        } else if (*p == '"') {
+            for (p++; p < End && *p != '"'; p++) {
+                Line += *p == '\n';
+            }
+            if (p < End) {
+                p++;
+            }
+        } else if (*p == '{') {
+            Depth++;
+            p++;
+        } else if (*p == '}') {
+            Depth -= Depth > 0;
+            p++;
+        } else if (IsLetter(*p) || *p == '_') {
+            Word = p;
+            while (p < End && (IsLetter(*p) || IsDigit(*p) || *p == '_')) {
+                p++;
+            }
+            if (Depth != 1 || p - Word != 2 || (Word[0] | 0x20) != 'i' || (Word[1] | 0x20) != 'd') {
+                continue;
+            }
+            IDLine = Line;
+            while (p < End && IsWhitespace(*p)) {
+                Line += *p++ == '\n';
+            }
+            if (p >= End || *p != '=') {
+                continue;
+            }
+            for (p++; p < End && IsWhitespace(*p); p++) {
+                Line += *p == '\n';
+            }
+            for (ID = 0; p < End && IsDigit(*p) && ID <= INT_MAX; p++) {
+                ID = ID * 10 + (*p - '0');
+            }
+            if (ID <= 0 || ID > INT_MAX) {
+                continue;
+            }
+            if (*Num >= Size) {
+                Size = Size > 0 ? Size * 2 : 256;
+                Refs = MemRealloc(Refs, Size * sizeof(EmpireEventRef));
+            }
+            Refs[*Num].ID = (int)ID;
+            Refs[*Num].Line = IDLine;
+            (*Num)++;
+        } else {
+            p++;
+        }
+    }
+    return(Refs);
+}
+
+// Simulation. Each province's RNGC events for an EventData are run as they
+// would be in the game, once for each of the Small/Normal/Large flags: the
+// flag picks at most one RNGC event of each Modification, and the province
+// converts if any of them chooses the option triggering the modification
+// event. With Random AI event choices that's a draw against the ai_chance,
+// with Historical ones it's whether converting is the first option. The
+// triggers are assumed to hold.
+#define SIM_LANES 8 // Trials run side by side, each with its own generator.
+
+typedef struct {
+    int Province, Event, Item;
+} SimMod;
+
+typedef struct {
+    Empire *E;
+    const SimMod *Mods;
+    const int *Cases;         // The first Mod of each case, and one past the last.
+    int First, End;           // The cases to run.
+    long long Trials;
+} SimArgs;
+
+static int CompareSimMods(const void *a, const void *b)
+{
+    const SimMod *x = a, *y = b;
+
+    if (x->Province != y->Province) {
+        return(x->Province < y->Province ? -1 : 1);
+    }
+    if (x->Event != y->Event) {
+        return(x->Event < y->Event ? -1 : 1);
+    }
+    return(x->Item < y->Item ? -1 : x->Item > y->Item);
+}
+
+// Seed a generator from a case and lane, so the results don't depend on
+// how the cases are spread over the threads (splitmix64, never 0).
+static unsigned int SimSeed(unsigned long long n)
+{
+    n += 0x9e3779b97f4a7c15ull;
+    n = (n ^ (n >> 30)) * 0xbf58476d1ce4e5b9ull;
+    n = (n ^ (n >> 27)) * 0x94d049bb133111ebull;
+    n ^= n >> 31;
+    return((unsigned int)n != 0 ? (unsigned int)n : 1);
+}
+
+// Count the trials where any of the NumEvents events converts. Each lane
+// runs a xorshift32 generator; the inner loops are over the lanes, so they
+// compile to vector code.
+static long long SimConversions(const unsigned int *Thresholds, int NumEvents, long long Trials, unsigned int *State)
+{
+    unsigned int x[SIM_LANES], Hit[SIM_LANES];
+    long long t, Hits = 0;
+    int e, l;
+
+    memcpy(x, State, sizeof(x));
+    for (t=0; t<Trials; t+=SIM_LANES) {
+        for (l=0; l<SIM_LANES; l++) {
+            Hit[l] = 0;
+        }
+        for (e=0; e<NumEvents; e++) {
+            for (l=0; l<SIM_LANES; l++) {
+                x[l] ^= x[l] << 13;
+                x[l] ^= x[l] >> 17;
+                x[l] ^= x[l] << 5;
+                Hit[l] |= x[l] <= Thresholds[e];
+            }
+        }
+        for (l=0; l<SIM_LANES; l++) {
+            Hits += Hit[l];
+        }
+    }
+    memcpy(State, x, sizeof(x));
+    return(Hits);
+}
+
+static void SimulateCase(Empire *E, const SimMod *Mods, int Num, int Case, long long Trials)
+{
+    EmpireSimResult *Result = &E->SimResults[Case];
+    const IRItem *Item;
+    unsigned int *Thresholds, State[SIM_LANES];
+    double p, NoConversion;
+    int Chances[3], Groups[3], f, i, j, k, n, Historical;
+
+    Item = &E->Items[Mods[0].Item];
+    Result->ProvinceID = Mods[0].Province;
+    Result->EventData = E->TagArray[E->EventData[Mods[0].Event][0]];
+    Result->FileName = E->Sections[Item->Section].FileName;
+    Result->NumModifications = Num;
+    Result->Trials = Trials;
+    // A version has one chance, so at most one event per Modification.
+    Thresholds = MemAlloc(Num * sizeof(unsigned int));
+    for (f=0; f<3; f++) {
+        NoConversion = 1.0;
+        Historical = 0;
+        k = 0;
+        for (i=0; i<Num; i++) {
+            Item = &E->Items[Mods[i].Item];
+            n = GroupChances(Item->Small, Item->Normal, Item->Large, Chances, Groups);
+            for (j=0; j<n; j++) {
+                if (!(Groups[j] & (1 << f))) {
+                    continue;
+                }
+                NoConversion *= 1.0 - Chances[j] / 100.0;
+                Historical |= RNGCTemplate(Chances[j]) != TEMPLATE_RNGC_LOW;
+                // Converts when the draw (1..2^32-1) is at most this.
+                Thresholds[k++] = Chances[j] == 100 ? UINT_MAX : (unsigned int)(Chances[j] * 4294967296.0 / 100.0);
+            }
+        }
+        for (i=0; i<SIM_LANES; i++) {
+            State[i] = SimSeed(((unsigned long long)Case * 3 + f) * SIM_LANES + i);
+        }
+        p = k > 0 ? (double)SimConversions(Thresholds, k, Trials, State) / Trials : 0.0;
+        Result->Expected[f] = 1.0 - NoConversion;
+        Result->Rate[f] = p;
+        Result->Error[f] = 1.96 * sqrt(p * (1.0 - p) / Trials);
+        Result->Historical[f] = Historical;
+    }
+    free(Thresholds);
+}
+
+static void SimulateCases(SimArgs *Args)
+{
+    int c;
+
+    for (c=Args->First; c<Args->End; c++) {
+        SimulateCase(Args->E, Args->Mods + Args->Cases[c], Args->Cases[c + 1] - Args->Cases[c], c, Args->Trials);
+    }
+}
+
+#ifndef _WIN32
+static void *SimWorker(void *Arg)
+{
+    SimulateCases(Arg);
+    return(NULL);
+}
+#endif
+
+int EmpireSimulate(Empire *E, long long Trials)
+{
+    const ProvinceGroup *Group;
+    const IRItem *Item;
+    SimMod *Mods;
+    SimArgs *Args;
+    int *Cases;
+    int i, p, n = 0, NumCases = 0, NumWorkers;
+#ifndef _WIN32
+    pthread_t *Threads;
+    int *Started;
+#endif
+
+    free(E->SimResults);
+    E->SimResults = NULL;
+    E->NumSimResults = 0;
+    if (!E->Parsed || E->NumErrors > 0 || Trials <= 0) {
+        return(0);
+    }
+    Trials = (Trials + SIM_LANES - 1) / SIM_LANES * SIM_LANES;
+    // The Modifications that generate anything, for each province.
+    for (i=0; i<E->NumItems; i++) {
+        Item = &E->Items[i];
+        if (Item->Kind == ITEM_MODIFICATION && CountRNGCEvents(Item->Small, Item->Normal, Item->Large) > 0) {
+            n += Item->Group < 0 ? 1 : E->ProvinceGroups[Item->Group].NumProvinces;
+        }
+    }
+    Mods = MemAlloc((n > 0 ? n : 1) * sizeof(SimMod));
+    n = 0;
+    for (i=0; i<E->NumItems; i++) {
+        Item = &E->Items[i];
+        if (Item->Kind != ITEM_MODIFICATION || CountRNGCEvents(Item->Small, Item->Normal, Item->Large) == 0) {
+            continue;
+        }
+        Group = Item->Group < 0 ? NULL : &E->ProvinceGroups[Item->Group];
+        for (p=Group == NULL ? Item->ProvinceID : NextInGroup(Group, 0); p>0; p=Group == NULL ? 0 : NextInGroup(Group, p)) {
+            Mods[n].Province = p;
+            Mods[n].Event = Item->Event;
+            Mods[n].Item = i;
+            n++;
+        }
+    }
+    // A case for each province and EventData.
+    qsort(Mods, n, sizeof(SimMod), CompareSimMods);
+    Cases = MemAlloc((n + 1) * sizeof(int));
+    for (i=0; i<n; i++) {
+        if (i == 0 || Mods[i].Province != Mods[i - 1].Province || Mods[i].Event != Mods[i - 1].Event) {
+            Cases[NumCases++] = i;
+        }
+    }
+    Cases[NumCases] = n;
+    E->SimResults = MemCalloc(NumCases > 0 ? NumCases : 1, sizeof(EmpireSimResult));
+    E->NumSimResults = NumCases;
+    NumWorkers = E->NumThreads < NumCases ? E->NumThreads : NumCases > 0 ? NumCases : 1;
+    Args = MemAlloc(NumWorkers * sizeof(SimArgs));
+    for (i=0; i<NumWorkers; i++) {
+        Args[i].E = E;
+        Args[i].Mods = Mods;
+        Args[i].Cases = Cases;
+        Args[i].First = (int)((long long)NumCases * i / NumWorkers);
+        Args[i].End = (int)((long long)NumCases * (i + 1) / NumWorkers);
+        Args[i].Trials = Trials;
+    }
+#ifndef _WIN32
+    Threads = MemAlloc(NumWorkers * sizeof(pthread_t));
+    Started = MemAlloc(NumWorkers * sizeof(int));
+    for (i=1; i<NumWorkers; i++) {
+        Started[i] = pthread_create(&Threads[i], NULL, SimWorker, &Args[i]) == 0;
+    }
+    SimulateCases(&Args[0]);
+    for (i=1; i<NumWorkers; i++) {
+        if (Started[i]) {
+            pthread_join(Threads[i], NULL);
+        } else {
+            SimulateCases(&Args[i]);
+        }
+    }
+    free(Threads);
+    free(Started);
+#else
+    for (i=0; i<NumWorkers; i++) {
+        SimulateCases(&Args[i]);
+    }
+#endif
+    free(Args);
+    free(Cases);
+    free(Mods);
+    return(NumCases);
+}
+
+const EmpireSimResult *EmpireGetSimResult(Empire *E, int i)
+{
+    return(&E->SimResults[i]);
+}
+
+int EmpireParse(Empire *E, const char *FileName, const char *Buf, size_t Len)
+{
+    if (E->Parsed) {
+        EmpireReset(E);
+    }
+    E->Parsed = 1;
+    ParseDataFile(E, FileName, Buf, Len);
+    if (E->NumErrors == 0) {
+        CheckProgram(E);
+    }
+    if (E->NumErrors == 0) {
+        AssignEventIDs(E);
+    }
+    if (E->NumErrors == 0) {
+        HashSections(E);
+        MakeOutputs(E);
+    }
+    return(E->NumErrors);
+}
+
+int EmpireNumOutputs(Empire *E)
+{
+    return(E->NumOutputs);
+}
+
+const EmpireOutput *EmpireGetOutput(Empire *E, int i)
+{
+    return(&E->Outputs[i]);
+}
+
+void EmpireSkipOutput(Empire *E, int i)
+{
+    E->Outputs[i].Skip = 1;
+    E->Sections[E->OutputSections[i]].Dirty = 0;
+}
+
+// Set up the state for a new data file.
+static void InitContext(Empire *E)
+{
+    InitTags(E);
+    InitTemplates(E);
+    E->RNGCTag = INT_MAX;
+    E->EventIDPrefix = INT_MAX;
+    E->OutputFileModHeader = "";
+    E->CurSection = E->CurModSection = -1;
+}
+
+// Free everything about the data file.
+static void FreeContext(Empire *E)
+{
+    FreeGenerated(E);
+    free(E->Tasks);
+    free(E->FlagStrings);
+    free(E->StringSplits);
+    FreeExpansions(E);
+    free(E->ProvinceGroups);
+    free(E->Outputs);
+    free(E->OutputSections);
+    free(E->Sections);
+    free(E->Items);
+    free(E->EventCounters);
+    free(E->EventIDs.Slots);
+    free(E->Overlaps);
+    free(E->SimResults);
+    free(E->TemplateSets);
+    free(E->EventData);
+    free(E->StringArray);
+    free(E->TagArray);
+    free(E->TagHashes);
+    free(E->TagBindings);
+    free(E->TagHashTable);
+    free(E->InternTable);
+    free(E->Diags);
+    free(E->Spans);
+    ArenaFree(&E->Arena);
+}
+
+Empire *EmpireCreate(void)
+{
+    Empire *E = MemCalloc(1, sizeof(Empire));
+
+    E->NumThreads = 1;
+    EmpireSetProvinces(E, MemCalloc(1, sizeof(EmpireProvinces)));
+    InitContext(E);
+    return(E);
+}
+
+void EmpireReset(Empire *E)
+{
+    EmpireProvinces *Provinces = E->Provinces;
+    EmpireIDRegistry *Registry = E->Registry;
+    EmpireDiagnosticHandler DiagHandler = E->DiagHandler;
+    void *DiagUser = E->DiagUser;
+    int NumThreads = E->NumThreads, Tracing = E->Tracing, Compact = E->Compact;
+
+    FreeContext(E);
+    memset(E, 0, sizeof(Empire));
+    E->Provinces = Provinces;
+    E->Registry = Registry;
+    E->DiagHandler = DiagHandler;
+    E->DiagUser = DiagUser;
+    E->NumThreads = NumThreads;
+    E->Tracing = Tracing;
+    E->Compact = Compact;
+    InitContext(E);
+}
+
+void EmpireDestroy(Empire *E)
+{
+    FreeContext(E);
+    EmpireSetProvinces(E, NULL);
+    free(E);
+}
+
+void EmpireSetDiagnosticHandler(Empire *E, EmpireDiagnosticHandler Handler, void *User)
+{
+    E->DiagHandler = Handler;
+    E->DiagUser = User;
+}
+
+void EmpireSetThreads(Empire *E, int NumThreads)
+{
+    E->NumThreads = NumThreads > 0 ? NumThreads : 1;
+}
+
+void EmpireSetCompact(Empire *E, int On)
+{
+    E->Compact = On;
+}
+
+EmpireProvinces *EmpireGetProvinces(Empire *E)
+{
+    return(E->Provinces);
+}
+
+void EmpireSetProvinces(Empire *E, EmpireProvinces *Provinces)
+{
+    EmpireProvinces *Old = E->Provinces;
+
+    if (Provinces != NULL) {
+        Provinces->RefCount++;
+    }
+    E->Provinces = Provinces;
+    if (Old != NULL && --Old->RefCount == 0) {
+        ArenaFree(&Old->Strings);
+        free(Old->Names);
+        free(Old);
+    }
+}
+
+EmpireIDRegistry *EmpireCreateIDRegistry(void)
+{
+    EmpireIDRegistry *R = MemCalloc(1, sizeof(EmpireIDRegistry));
+
+#ifndef _WIN32
+    pthread_mutex_init(&R->Lock, NULL);
+#endif
+    return(R);
+}
+
+void EmpireDestroyIDRegistry(EmpireIDRegistry *R)
+{
+    int i;
+
+    for (i=0; i<R->NumOwners; i++) {
+        free(R->Owners[i]);
+    }
+    free(R->Owners);
+    free(R->IDs.Slots);
+#ifndef _WIN32
+    pthread_mutex_destroy(&R->Lock);
+#endif
+    free(R);
+}
+
+void EmpireSetIDRegistry(Empire *E, EmpireIDRegistry *R)
+{
+    E->Registry = R;
+}
+
+int EmpireNumErrors(Empire *E)
+{
+    return(E->NumErrors);
+}
+
+int EmpireNumWarnings(Empire *E)
+{
+    return(E->NumWarnings);
+}
+
+int EmpireNumDiagnostics(Empire *E)
+{
+    return(E->NumDiags);
+}
+
+const EmpireDiagnostic *EmpireGetDiagnostic(Empire *E, int i)
+{
+    return(&E->Diags[i]);
+}
+
+const EmpireStats *EmpireGetStats(Empire *E)
+{
+    return(&E->Stats);
+}
+
+void EmpireSetTracing(Empire *E, int On)
+{
+    E->Tracing = On;
+}
+
+int EmpireNumSpans(Empire *E)
+{
+    return(E->NumSpans);
+}
+
+const EmpireSpan *EmpireGetSpan(Empire *E, int i)
+{
+    return(&E->Spans[i]);
+}
+
+double EmpireClock(void)
+{
+#ifdef _WIN32
+    LARGE_INTEGER Freq, Count;
+
+    QueryPerformanceFrequency(&Freq);
+    QueryPerformanceCounter(&Count);
+    return((double)Count.QuadPart * 1000000.0 / (double)Freq.QuadPart);
+#else
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return((double)t.tv_sec * 1000000.0 + (double)t.tv_nsec / 1000.0);
+#endif
+}